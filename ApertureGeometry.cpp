@@ -0,0 +1,44 @@
+#include "ApertureGeometry.hpp"
+#include <cmath>
+
+ApertureGeometry::ApertureGeometry(Parameters const& params)
+    : params_(params)
+{
+    using namespace glm;
+    using namespace std;
+
+    const auto sqr = [](auto x){ return x*x; };
+    const float PI = acos(-1.);
+
+    const int pointCount = params.pointCount;
+    const float globalRotationAngle = params.globalRotationAngle;
+    const float curvatureRadius = params.curvatureRadius;
+    const float arcPointCount = params.arcPointCount;
+
+    for(int pointNum=1; pointNum<=pointCount; ++pointNum)
+    {
+        float phi1 = 2*PI*(pointNum-1)/pointCount + (pointCount%2==1 ? PI/2 : 0) + globalRotationAngle;
+        float phi2 = 2*PI* pointNum   /pointCount + (pointCount%2==1 ? PI/2 : 0) + globalRotationAngle;
+        vec2 p1=vec2(cos(phi1), sin(phi1));
+        vec2 p2=vec2(cos(phi2), sin(phi2));
+        vec2 midPoint = (p1+p2)/2.f;
+        float arcCenterDistFromMid = sqrt(sqr(curvatureRadius)-dot(p1-p2,p1-p2)/4);
+        vec2 arcCenter = midPoint * (1-arcCenterDistFromMid/length(midPoint));
+        float arcPhi1 = atan2(p1.y-arcCenter.y, p1.x-arcCenter.x);
+        float arcPhi2 = atan2(p2.y-arcCenter.y, p2.x-arcCenter.x);
+        if(arcPhi2<arcPhi1) arcPhi2 += 2*PI;
+        // The last point of the arc is the first point of the next one, so it's not included here
+        for(float arcPointNum=0; arcPointNum<=arcPointCount; ++arcPointNum)
+        {
+            float angle=arcPhi1+(arcPhi2-arcPhi1)*arcPointNum/(arcPointCount+1);
+            vertices_.push_back(arcCenter + curvatureRadius*vec2(cos(angle), sin(angle)));
+        }
+    }
+}
+
+double ApertureGeometry::mirrorAxisAngle() const
+{
+    // The axis passes through the first vertex of the polygon
+    const double PI = std::acos(-1.);
+    return (params_.pointCount%2==1 ? PI/2 : 0) + params_.globalRotationAngle;
+}
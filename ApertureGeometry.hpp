@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Outline of the aperture: a regular polygon with sides replaced by circular arcs, the arcs
+// being approximated by polylines. It's computed once per change of shape parameters and
+// shared by the glare renderers and the outline widget.
+class ApertureGeometry
+{
+public:
+    struct Parameters
+    {
+        int pointCount;
+        int arcPointCount;
+        double curvatureRadius; // in units of aperture radius
+        double globalRotationAngle;
+
+        bool operator==(Parameters const& other) const
+        {
+            return pointCount==other.pointCount && arcPointCount==other.arcPointCount &&
+                   curvatureRadius==other.curvatureRadius && globalRotationAngle==other.globalRotationAngle;
+        }
+        bool operator!=(Parameters const& other) const { return !(*this==other); }
+    };
+
+    explicit ApertureGeometry(Parameters const& params);
+
+    Parameters const& parameters() const { return params_; }
+    // Vertices of the closed outline in units of aperture radius, pointCount*(arcPointCount+1)
+    // of them. Each pair of consecutive vertices forms a triangle with the origin.
+    std::vector<glm::vec2> const& vertices() const { return vertices_; }
+    int triangleCount() const { return vertices_.size(); }
+    // Triangles of side s are those numbered from s*trianglesPerSide() to (s+1)*trianglesPerSide()-1
+    int trianglesPerSide() const { return params_.arcPointCount+1; }
+    // Order of the rotational symmetry of the outline; 1 means the aperture is asymmetric.
+    // A symmetric aperture is also assumed to be mirror-symmetric about mirrorAxisAngle().
+    int symmetryOrder() const { return params_.pointCount; }
+    double mirrorAxisAngle() const;
+    glm::vec2 triangleVertex1(int n) const { return vertices_[n]; }
+    glm::vec2 triangleVertex2(int n) const { return vertices_[(n+1)%vertices_.size()]; }
+
+private:
+    Parameters params_;
+    std::vector<glm::vec2> vertices_;
+};
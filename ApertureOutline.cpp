@@ -3,7 +3,6 @@
 #include <QPainter>
 #include <QMessageBox>
 #include <QOpenGLFunctions_3_3_Core>
-#include <glm/glm.hpp>
 #include "ToolsWidget.hpp"
 #include "common.hpp"
 
@@ -41,6 +40,7 @@ void ApertureOutline::setupBuffers()
     if(vbo_)
         glDeleteBuffers(1, &vbo_);
     glGenBuffers(1, &vbo_);
+    uploadedGeometry_.reset();
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
     constexpr GLuint attribIndex=0;
     constexpr int coordsPerVertex=2;
@@ -100,47 +100,19 @@ void ApertureOutline::paintGL()
     glClear(GL_COLOR_BUFFER_BIT);
     glDisable(GL_SCISSOR_TEST);
 
-    using namespace glm;
-    using namespace std;
+    const auto geometry = tools_->apertureGeometry();
+    const auto& vertices = geometry->vertices();
 
-    const auto sqr = [](auto x){ return x*x; };
-    const float PI = acos(-1.);
-
-    const int pointCount = tools_->pointCount();
-    const float globalRotationAngle = tools_->globalRotationAngle();
-    const float curvatureRadius = tools_->curvatureRadius();
-    const float arcPointCount = tools_->arcPointCount();
-
-    std::vector<vec2> vertices;
-    for(int pointNum=1; pointNum<=pointCount; ++pointNum)
+    glBindVertexArray(vao_);
+    if(geometry != uploadedGeometry_)
     {
-        float phi1 = 2*PI*(pointNum-1)/pointCount + (pointCount%2==1 ? PI/2 : 0) + globalRotationAngle;
-        float phi2 = 2*PI* pointNum   /pointCount + (pointCount%2==1 ? PI/2 : 0) + globalRotationAngle;
-        vec2 p1=vec2(cos(phi1), sin(phi1));
-        vec2 p2=vec2(cos(phi2), sin(phi2));
-        vec2 midPoint = (p1+p2)/2.f;
-        float arcCenterDistFromMid = sqrt(sqr(curvatureRadius)-dot(p1-p2,p1-p2)/4);
-        vec2 arcCenter = midPoint * (1-arcCenterDistFromMid/length(midPoint));
-        float arcPhi1 = atan(p1.y-arcCenter.y, p1.x-arcCenter.x);
-        float arcPhi2 = atan(p2.y-arcCenter.y, p2.x-arcCenter.x);
-        if(arcPhi2<arcPhi1) arcPhi2 += 2*PI;
-        for(float arcPointNum=0; arcPointNum<=arcPointCount; ++arcPointNum)
-        {
-            float angle1=arcPhi1+(arcPhi2-arcPhi1)* arcPointNum   /(arcPointCount+1);
-            float angle2=arcPhi1+(arcPhi2-arcPhi1)*(arcPointNum+1)/(arcPointCount+1);
-            vec2 arcP1 = arcCenter + curvatureRadius*vec2(cos(angle1), sin(angle1));
-            vec2 arcP2 = arcCenter + curvatureRadius*vec2(cos(angle2), sin(angle2));
-            vertices.push_back(arcP1);
-            vertices.push_back(arcP2);
-        }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof vertices[0], vertices.data(), GL_DYNAMIC_DRAW);
+        uploadedGeometry_ = geometry;
     }
 
-    glBindVertexArray(vao_);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof vertices[0], vertices.data(), GL_DYNAMIC_DRAW);
-
     renderProgram_->bind();
-    glDrawArrays(GL_LINES, 0, vertices.size());
+    glDrawArrays(GL_LINE_LOOP, 0, vertices.size());
     renderProgram_->release();
     glBindVertexArray(0);
 }
@@ -6,6 +6,7 @@
 #include <QOpenGLFunctions_3_3_Core>
 
 class ToolsWidget;
+class ApertureGeometry;
 class ApertureOutline : public QOpenGLWidget, public QOpenGLFunctions_3_3_Core
 {
     Q_OBJECT
@@ -26,4 +27,5 @@ private:
     std::unique_ptr<QOpenGLShaderProgram> renderProgram_;
     GLuint vao_=0;
     GLuint vbo_=0;
+    std::shared_ptr<const ApertureGeometry> uploadedGeometry_;
 };
@@ -0,0 +1,257 @@
+#include "BatchJob.hpp"
+#include <cmath>
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QSettings>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+
+namespace
+{
+const char*const keys[][2]=
+{
+    {"name",            "name of the job in the JSON file; INI files use the section name"},
+    {"output",          "path of the TIFF file, <job name>.tiff by default"},
+    {"width",           "image width in px"},
+    {"height",          "image height in px"},
+    {"pointCount",      "aperture edge count"},
+    {"arcPointCount",   "points per arc (side)"},
+    {"apertureRadius",  "radius of aperture in mm"},
+    {"curvatureRadius", "radius of curvature of side in units of aperture radius"},
+    {"rotationAngle",   "rotation angle in degrees"},
+    {"screenWidth",     "screen width 10 m away, in m"},
+    {"sampleCount",     "samples per pixel side"},
+    {"wavelengthCount", "number of wavelengths"},
+    {"spectralRule",    "spectral quadrature: trapezoid, gauss-legendre or importance"},
+    {"lightSource",     "D65, blackbody, or the path of a spectrum file"},
+    {"temperature",     "blackbody temperature in K"},
+    {"edgeFormula",     "whether to sum the transform over aperture edges"},
+    {"normalize",       "whether to scale the image so that its brightest channel is 1, true by default; "
+                        "otherwise the linear sRGB values are written as rendered"},
+    {"tileSize",        "if nonzero, a multiple of 16: the image is rendered in tiles of this size, streamed "
+                        "to a tiled BigTIFF, and an interrupted job resumes from the tiles already written. "
+                        "Tiled images can't be normalized, as their maximum isn't known until the last tile, "
+                        "so normalize must be false"},
+};
+}
+
+bool BatchJob::set(QVariantMap const& values, QString const& baseDir, QString& error)
+{
+    for(auto it=values.begin(); it!=values.end(); ++it)
+    {
+        const auto& key = it.key();
+        const auto& value = it.value();
+        bool ok=true;
+        if(key=="name") name = value.toString();
+        else if(key=="output") output = QDir(baseDir).absoluteFilePath(value.toString());
+        else if(key=="width") width = value.toInt(&ok);
+        else if(key=="height") height = value.toInt(&ok);
+        else if(key=="pointCount") pointCount = value.toInt(&ok);
+        else if(key=="arcPointCount") arcPointCount = value.toInt(&ok);
+        else if(key=="apertureRadius") apertureRadius = value.toDouble(&ok);
+        else if(key=="curvatureRadius") curvatureRadius = value.toDouble(&ok);
+        else if(key=="rotationAngle") rotationAngle = value.toDouble(&ok);
+        else if(key=="screenWidth") screenWidth = value.toDouble(&ok);
+        else if(key=="sampleCount") sampleCount = value.toInt(&ok);
+        else if(key=="wavelengthCount") wavelengthCount = value.toInt(&ok);
+        else if(key=="temperature") temperature = value.toDouble(&ok);
+        else if(key=="tileSize") tileSize = value.toInt(&ok);
+        else if(key=="lightSource") lightSource = value.toString();
+        else if(key=="edgeFormula" || key=="normalize")
+        {
+            const auto str = value.toString().toLower();
+            ok = value.userType()==QMetaType::Bool || str=="true" || str=="false" || str=="1" || str=="0";
+            (key=="edgeFormula" ? edgeFormula : normalize) = value.toBool();
+        }
+        else if(key=="spectralRule")
+        {
+            const auto rule = value.toString().toLower();
+            if(rule=="trapezoid") spectralRule = SpectralQuadrature::Rule::Trapezoid;
+            else if(rule=="gauss-legendre") spectralRule = SpectralQuadrature::Rule::GaussLegendre;
+            else if(rule=="importance") spectralRule = SpectralQuadrature::Rule::Importance;
+            else ok=false;
+        }
+        else
+        {
+            error = QObject::tr("unknown key \"%1\"").arg(key);
+            return false;
+        }
+        if(!ok)
+        {
+            error = QObject::tr("bad value \"%1\" of %2").arg(value.toString(), key);
+            return false;
+        }
+    }
+
+    if(width<1 || height<1 || pointCount<3 || arcPointCount<0 || sampleCount<1 || wavelengthCount<1 ||
+       !(apertureRadius>0) || !(curvatureRadius>=1) || !(screenWidth>0) || !std::isfinite(rotationAngle) ||
+       tileSize<0 || tileSize%16)
+    {
+        error = QObject::tr("parameters out of range");
+        return false;
+    }
+    if(tileSize && normalize)
+    {
+        error = QObject::tr("tiled images can't be normalized, set normalize to false");
+        return false;
+    }
+
+    if(lightSource.compare("D65", Qt::CaseInsensitive)==0)
+    {
+        sourceSpectrum = std::make_shared<const SourceSpectrum>(SourceSpectrum::d65());
+    }
+    else if(lightSource.compare("blackbody", Qt::CaseInsensitive)==0)
+    {
+        if(!(temperature>0))
+        {
+            error = QObject::tr("bad blackbody temperature %1").arg(temperature);
+            return false;
+        }
+        sourceSpectrum = std::make_shared<const SourceSpectrum>(SourceSpectrum::blackbody(temperature));
+    }
+    else
+    {
+        const auto path = QDir(baseDir).absoluteFilePath(lightSource);
+        QString spectrumError;
+        const auto spectrum = SourceSpectrum::fromCSV(path, spectrumError);
+        if(!spectrum)
+        {
+            error = QObject::tr("failed to load spectrum from %1: %2").arg(path, spectrumError);
+            return false;
+        }
+        sourceSpectrum = std::make_shared<const SourceSpectrum>(*spectrum);
+    }
+    return true;
+}
+
+CPUGlareRenderer::Parameters BatchJob::parameters(SpectralQuadrature& quadrature) const
+{
+    CPUGlareRenderer::Parameters params;
+    // Same conversion of the angle as in ToolsWidget::globalRotationAngle()
+    params.geometry = std::make_shared<const ApertureGeometry>(
+                        ApertureGeometry::Parameters{pointCount, arcPointCount, curvatureRadius,
+                                                     rotationAngle*-std::acos(-1.)/180});
+    params.apertureRadius = apertureRadius;
+    params.targetWidth = 1000*screenWidth;
+    params.sampleCount = sampleCount;
+    params.formula = edgeFormula ? TriangleKernel::Formula::Edges : TriangleKernel::Formula::Triangles;
+    for(const auto& node : quadrature.nodes(*sourceSpectrum, spectralRule, wavelengthCount))
+        params.wavelengths.push_back(CPUGlareRenderer::wavelength(node, sampleCount));
+    return params;
+}
+
+QByteArray BatchJob::renderKey() const
+{
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << qint32(CPUGlareRenderer::version) << width << height << tileSize << pointCount << arcPointCount << apertureRadius << curvatureRadius
+           << rotationAngle << screenWidth << sampleCount << wavelengthCount << int(spectralRule)
+           << sourceSpectrum->key() << edgeFormula;
+    return key;
+}
+
+std::vector<BatchJob> BatchJob::load(QString const& path, QString& error)
+{
+    const QFileInfo info(path);
+    const auto baseDir = info.absolutePath();
+
+    QVariantMap defaults;
+    std::vector<QVariantMap> jobValues;
+    if(info.suffix().compare("ini", Qt::CaseInsensitive)==0)
+    {
+        if(!info.isReadable())
+        {
+            error = QObject::tr("can't read the file");
+            return {};
+        }
+        QSettings settings(path, QSettings::IniFormat);
+        for(const auto& key : settings.childKeys())
+            defaults[key] = settings.value(key);
+        for(const auto& group : settings.childGroups())
+        {
+            QVariantMap values{{"name", group}};
+            settings.beginGroup(group);
+            for(const auto& key : settings.childKeys())
+                values[key] = settings.value(key);
+            settings.endGroup();
+            jobValues.push_back(values);
+        }
+        if(settings.status() != QSettings::NoError)
+        {
+            error = QObject::tr("failed to parse the file");
+            return {};
+        }
+    }
+    else
+    {
+        QFile file(path);
+        if(!file.open(QIODevice::ReadOnly))
+        {
+            error = file.errorString();
+            return {};
+        }
+        QJsonParseError parseError;
+        const auto doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+        if(doc.isNull())
+        {
+            error = parseError.errorString();
+            return {};
+        }
+        QJsonArray jobs;
+        if(doc.isArray())
+        {
+            jobs = doc.array();
+        }
+        else
+        {
+            defaults = doc.object().value("defaults").toObject().toVariantMap();
+            jobs = doc.object().value("jobs").toArray();
+        }
+        for(int n=0; n<jobs.size(); ++n)
+        {
+            auto values = jobs[n].toObject().toVariantMap();
+            if(!values.contains("name"))
+                values["name"] = QString("job%1").arg(n+1);
+            jobValues.push_back(values);
+        }
+    }
+    if(jobValues.empty())
+    {
+        error = QObject::tr("no jobs found");
+        return {};
+    }
+
+    BatchJob defaultJob;
+    if(!defaultJob.set(defaults, baseDir, error))
+    {
+        error = QObject::tr("defaults: %1").arg(error);
+        return {};
+    }
+    std::vector<BatchJob> jobs;
+    for(const auto& values : jobValues)
+    {
+        BatchJob job = defaultJob;
+        job.output.clear();
+        if(!job.set(values, baseDir, error))
+        {
+            error = QObject::tr("job %1: %2").arg(values["name"].toString(), error);
+            return {};
+        }
+        if(job.output.isEmpty())
+            job.output = QDir(baseDir).absoluteFilePath(job.name+".tiff");
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+QString BatchJob::keyDescriptions()
+{
+    QString text;
+    for(const auto& [key, description] : keys)
+        text += QString("  %1 %2\n").arg(key, -17).arg(description);
+    return text;
+}
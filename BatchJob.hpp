@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <QString>
+#include <QByteArray>
+#include <QVariantMap>
+#include "CPUGlareRenderer.hpp"
+#include "SpectralQuadrature.hpp"
+
+// One image for the headless renderer: the settings of ToolsWidget that affect the CPU
+// renderer, plus the image size and the output path. Defaults are those of the UI.
+struct BatchJob
+{
+    QString name;
+    QString output;
+    int width=1024, height=1024; // px
+    int pointCount=6;
+    int arcPointCount=25;
+    double apertureRadius=1; // mm
+    double curvatureRadius=3; // in units of aperture radius
+    double rotationAngle=14; // degrees, as in the UI
+    double screenWidth=1; // m
+    int sampleCount=1;
+    int wavelengthCount=256;
+    SpectralQuadrature::Rule spectralRule=SpectralQuadrature::Rule::Trapezoid;
+    QString lightSource="D65"; // or "blackbody", or the path of a spectrum file
+    double temperature=5800; // K, for the blackbody
+    std::shared_ptr<const SourceSpectrum> sourceSpectrum; // loaded from the above
+    bool edgeFormula=true;
+    bool normalize=true; // scale the image so that its brightest channel is 1
+    int tileSize=0; // px, 0 to render the whole image at once
+
+    CPUGlareRenderer::Parameters parameters(SpectralQuadrature& quadrature) const;
+    // Everything the image depends on, apart from the output path, including the version of the renderer
+    QByteArray renderKey() const;
+
+    // Reads a JSON file with either an array of job objects or an object with "defaults"
+    // and "jobs", or an INI file where each section is a job and the keys outside of
+    // sections are the defaults. Relative paths are resolved against the job file.
+    static std::vector<BatchJob> load(QString const& path, QString& error);
+    // Names of the keys, with their meaning, for the help text
+    static QString keyDescriptions();
+
+private:
+    bool set(QVariantMap const& values, QString const& baseDir, QString& error);
+};
@@ -0,0 +1,188 @@
+#include "BigTiffWriter.hpp"
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <QSysInfo>
+#ifdef Q_OS_WIN
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
+namespace
+{
+// Field types
+enum : quint16
+{
+    ASCII=2,
+    SHORT=3,
+    LONG=4,
+    LONG8=16,
+};
+
+constexpr quint64 headerSize=16;
+constexpr int directoryEntryCount=13;
+// Entry count, the entries of 20 bytes each, and the offset of the next directory
+constexpr quint64 directorySize=8+directoryEntryCount*20+8;
+// Position of TileByteCounts among the entries, which are sorted by tag
+constexpr int byteCountsEntryIndex=11;
+
+template<typename T> void append(QByteArray& data, const T value)
+{
+    data.append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+template<typename T> QByteArray values(std::initializer_list<T> list)
+{
+    QByteArray data;
+    for(const auto value : list)
+        append(data, value);
+    return data;
+}
+
+quint64 alignUp(const quint64 offset, const quint64 alignment)
+{
+    return (offset+alignment-1)/alignment*alignment;
+}
+
+// Unlike QFile::flush(), which only hands the data to the OS, waits until it's on the disk.
+// Returns an empty string on success, the error otherwise.
+QString syncData(QFile& file)
+{
+    if(!file.flush())
+        return file.errorString();
+#if defined(Q_OS_WIN)
+    const int result = _commit(file.handle());
+#elif defined(Q_OS_DARWIN)
+    const int result = fsync(file.handle());
+#else
+    const int result = fdatasync(file.handle());
+#endif
+    return result==0 ? QString() : QString::fromLocal8Bit(std::strerror(errno));
+}
+}
+
+BigTiffWriter::BigTiffWriter(QString const& path, const int width, const int height, const int tileSize,
+                             QString const& description)
+    : file_(path)
+    , width_(width)
+    , height_(height)
+    , tileSize_(tileSize)
+    , description_(description.toUtf8())
+    , written_(tileCount(), false)
+{
+    const quint64 n = tileCount();
+    // Values of up to 8 bytes are stored in the directory entry itself
+    const quint64 descriptionSize = description_.size()+1;
+    const quint64 descriptionEnd = headerSize + directorySize + (descriptionSize > 8 ? descriptionSize : 0);
+    tileOffsetsOffset_ = alignUp(descriptionEnd, 8);
+    byteCountsOffset_ = n==1 ? headerSize + 8 + byteCountsEntryIndex*20 + 12 : tileOffsetsOffset_ + n*8;
+    dataOffset_ = alignUp(n==1 ? descriptionEnd : byteCountsOffset_ + n*8, 4096);
+}
+
+// Everything before the tile data, with all byte counts zero
+QByteArray BigTiffWriter::metadata() const
+{
+    const quint64 n = tileCount();
+    const quint64 descriptionSize = description_.size()+1;
+    QByteArray data;
+    // The byte order is the native one, so that the tiles are written as they are
+    data.append(QSysInfo::ByteOrder==QSysInfo::LittleEndian ? "II" : "MM", 2);
+    append(data, quint16(43)); // BigTIFF
+    append(data, quint16(8)); // size of offsets
+    append(data, quint16(0));
+    append(data, headerSize); // offset of the only directory
+
+    append(data, quint64(directoryEntryCount));
+    const auto entry = [&](const quint16 tag, const quint16 type, const quint64 count, QByteArray const& value)
+    {
+        append(data, tag);
+        append(data, type);
+        append(data, count);
+        data.append(value);
+        data.append(QByteArray(8-value.size(), '\0'));
+    };
+    entry(256, LONG, 1, values<quint32>({quint32(width_)})); // ImageWidth
+    entry(257, LONG, 1, values<quint32>({quint32(height_)})); // ImageLength
+    entry(258, SHORT, 3, values<quint16>({32, 32, 32})); // BitsPerSample
+    entry(259, SHORT, 1, values<quint16>({1})); // Compression: none
+    entry(262, SHORT, 1, values<quint16>({2})); // PhotometricInterpretation: RGB
+    entry(270, ASCII, descriptionSize, descriptionSize > 8 ? values<quint64>({headerSize + directorySize})
+                                                            : description_+'\0'); // ImageDescription
+    entry(277, SHORT, 1, values<quint16>({3})); // SamplesPerPixel
+    entry(284, SHORT, 1, values<quint16>({1})); // PlanarConfiguration: interleaved
+    entry(322, LONG, 1, values<quint32>({quint32(tileSize_)})); // TileWidth
+    entry(323, LONG, 1, values<quint32>({quint32(tileSize_)})); // TileLength
+    entry(324, LONG8, n, values<quint64>({n==1 ? dataOffset_ : tileOffsetsOffset_})); // TileOffsets
+    entry(325, LONG8, n, values<quint64>({n==1 ? 0 : byteCountsOffset_})); // TileByteCounts
+    entry(339, SHORT, 3, values<quint16>({3, 3, 3})); // SampleFormat: IEEE float
+    append(data, quint64(0)); // no next directory
+
+    if(descriptionSize > 8)
+    {
+        data.append(description_);
+        data.append('\0');
+    }
+    if(n > 1)
+    {
+        data.append(QByteArray(tileOffsetsOffset_-data.size(), '\0'));
+        for(quint64 index=0; index<n; ++index)
+            append(data, dataOffset_ + index*tileBytes());
+        data.append(QByteArray(n*8, '\0'));
+    }
+    data.append(QByteArray(dataOffset_-data.size(), '\0'));
+    return data;
+}
+
+QString BigTiffWriter::open()
+{
+    std::fill(written_.begin(), written_.end(), false);
+    if(!file_.open(QIODevice::ReadWrite))
+        return file_.errorString();
+
+    const quint64 n = tileCount();
+    const quint64 fileSize = dataOffset_ + n*tileBytes();
+    const auto expected = metadata();
+    auto existing = file_.read(expected.size());
+    if(existing.size() == expected.size() && quint64(file_.size()) == fileSize)
+    {
+        // The byte counts are the only part that differs
+        std::vector<quint64> byteCounts(n);
+        std::memcpy(byteCounts.data(), existing.constData()+byteCountsOffset_, n*8);
+        std::memset(existing.data()+byteCountsOffset_, 0, n*8);
+        if(existing == expected)
+        {
+            for(quint64 index=0; index<n; ++index)
+                written_[index] = byteCounts[index] == tileBytes();
+            return {};
+        }
+    }
+
+    // Anything else is started over. The tiles not written yet stay holes in a sparse file.
+    if(!file_.resize(0) || !file_.seek(0) || file_.write(expected) != expected.size() ||
+       !file_.resize(fileSize) || !file_.flush())
+        return file_.errorString();
+    return {};
+}
+
+int BigTiffWriter::writtenTileCount() const
+{
+    return std::count(written_.begin(), written_.end(), true);
+}
+
+QString BigTiffWriter::writeTile(const int index, const float*const rgb)
+{
+    // The data reaches the disk before the byte count is written, so that an interruption, even
+    // by a crash of the system, leaves the tile unwritten rather than corrupt
+    const quint64 bytes = tileBytes();
+    if(!file_.seek(dataOffset_ + index*bytes) ||
+       file_.write(reinterpret_cast<const char*>(rgb), bytes) != qint64(bytes))
+        return file_.errorString();
+    if(const auto error = syncData(file_); !error.isEmpty())
+        return error;
+    if(!file_.seek(byteCountsOffset_ + index*8) ||
+       file_.write(reinterpret_cast<const char*>(&bytes), sizeof bytes) != qint64(sizeof bytes) || !file_.flush())
+        return file_.errorString();
+    written_[index]=true;
+    return {};
+}
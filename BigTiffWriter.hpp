@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+
+// Streams a float RGB image to a tiled BigTIFF one tile at a time, so that images larger than
+// the memory, or than the 4 GiB of classic TIFF, can be written. The tiles are uncompressed and
+// their places in the file are fixed up front, along with the rest of the layout. A tile counts
+// as written once its byte count is set, so an interrupted export can be reopened and only the
+// missing tiles written.
+class BigTiffWriter
+{
+public:
+    // The tile size must be a multiple of 16. The description goes to the ImageDescription tag,
+    // and a file is only resumed if it has the same one.
+    BigTiffWriter(QString const& path, int width, int height, int tileSize, QString const& description);
+
+    // Reopens the file if it was started with the same layout, otherwise creates it anew.
+    // Returns an empty string on success, the error otherwise.
+    QString open();
+    int tilesAcross() const { return (width_+tileSize_-1)/tileSize_; }
+    int tilesDown() const { return (height_+tileSize_-1)/tileSize_; }
+    int tileCount() const { return tilesAcross()*tilesDown(); }
+    // Tiles are numbered row by row from the top left corner of the image
+    bool tileWritten(int index) const { return written_[index]; }
+    int writtenTileCount() const;
+    // Writes tileSize² RGB triplets, row by row from the top; the parts of the edge tiles
+    // outside of the image are ignored by readers. Returns an empty string on success, the
+    // error otherwise.
+    QString writeTile(int index, const float* rgb);
+
+private:
+    QByteArray metadata() const;
+    quint64 tileBytes() const { return quint64(tileSize_)*tileSize_*3*sizeof(float); }
+
+private:
+    QFile file_;
+    int width_, height_, tileSize_;
+    QByteArray description_;
+    std::vector<bool> written_;
+    // Positions in the file
+    quint64 tileOffsetsOffset_=0;
+    quint64 byteCountsOffset_=0;
+    quint64 dataOffset_=0;
+};
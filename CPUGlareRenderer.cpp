@@ -0,0 +1,103 @@
+#include "CPUGlareRenderer.hpp"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+template<typename T> auto sqr(T x) { return x*x; }
+}
+
+CPUGlareRenderer::Wavelength CPUGlareRenderer::wavelength(SpectralQuadrature::Node const& node, const int sampleCount)
+{
+    const auto wavelengthToWavenumber = [](const float wavelength){ return float(2e6*M_PI / wavelength); };
+    const float wavenumber = wavelengthToWavenumber(node.wavelength);
+    // Same as Canvas::colorScale(), with the average over the grid of samples folded in
+    const float colorScale = sqr(wavenumber / wavelengthToWavenumber(555)) / sqr(sampleCount);
+    return {wavenumber, colorScale * node.weight};
+}
+
+void CPUGlareRenderer::setParameters(Parameters const& params)
+{
+    params_=params;
+    // The outline is a closed loop, so the fan built below is closed, as the edge formula requires
+    kernel_.setFormula(params.formula);
+
+    triangles_.clear();
+    const auto& geometry = *params.geometry;
+    for(int n=0; n<geometry.triangleCount(); ++n)
+    {
+        const auto v1 = params.apertureRadius * geometry.triangleVertex1(n);
+        const auto v2 = params.apertureRadius * geometry.triangleVertex2(n);
+        triangles_.push_back({v1, v2, TriangleKernel::triangleArea(glm::vec2(0), v1, v2)});
+    }
+}
+
+void CPUGlareRenderer::setImageSize(const int width, const int height)
+{
+    width_=width;
+    height_=height;
+}
+
+void CPUGlareRenderer::renderTile(Tile const& tile, glm::vec4*const out, const size_t stride) const
+{
+    using namespace glm;
+
+    const vec2 imageSize(width_, height_);
+    const int sampleCount=params_.sampleCount;
+    const auto w=size_t(tile.width);
+    for(int row=0; row<tile.height; ++row)
+        std::fill(out+row*stride, out+row*stride+w, vec4(0));
+
+    // Directions are computed for a whole row of the tile, then the kernel evaluates them in SIMD batches
+    std::vector<float> dirX(w), dirY(w), kx(w), ky(w), re(w), im(w);
+    for(int sampleNumY=0; sampleNumY<sampleCount; ++sampleNumY)
+    {
+        for(int sampleNumX=0; sampleNumX<sampleCount; ++sampleNumX)
+        {
+            const vec2 sampleShift = vec2(sampleNumX+0.5f, sampleNumY+0.5f)/float(sampleCount);
+            for(int row=0; row<tile.height; ++row)
+            {
+                for(size_t col=0; col<w; ++col)
+                {
+                    const vec2 fragCoord(tile.x+col+0.5f, tile.y+row+0.5f);
+                    // Distance from the center in mm at a distance of 10m from the aperture
+                    const vec2 pointInTargetPlane = (fragCoord - round(imageSize/2.f) + sampleShift) / (imageSize.x/2) * params_.targetWidth;
+                    constexpr float distToTargetPlane = 10e3; // mm
+                    // Distance from the center of the aperture to the point in the target plane
+                    const float distToPoint = std::sqrt(dot(pointInTargetPlane, pointInTargetPlane) + sqr(distToTargetPlane));
+                    dirX[col] = pointInTargetPlane.x / distToPoint;
+                    dirY[col] = pointInTargetPlane.y / distToPoint;
+                }
+
+                const auto outRow = out+row*stride;
+                for(const auto& wl : params_.wavelengths)
+                {
+                    // Projection of the wave vector onto the plane of the aperture
+                    for(size_t col=0; col<w; ++col)
+                    {
+                        kx[col] = wl.wavenumber * dirX[col];
+                        ky[col] = wl.wavenumber * dirY[col];
+                    }
+                    kernel_.evaluate(triangles_.data(), triangles_.size(), kx.data(), ky.data(), w, re.data(), im.data());
+                    for(size_t col=0; col<w; ++col)
+                        outRow[col] += wl.radianceToLuminance*(re[col]*re[col]+im[col]*im[col]);
+                }
+            }
+        }
+    }
+}
+
+std::vector<CPUGlareRenderer::Tile> CPUGlareRenderer::tiles(const int width, const int height, const int tileSize)
+{
+    std::vector<Tile> tiles;
+    for(int y=0; y<height; y+=tileSize)
+        for(int x=0; x<width; x+=tileSize)
+            tiles.push_back({x, y, std::min(tileSize, width-x), std::min(tileSize, height-y)});
+
+    const auto distSqr = [=](Tile const& t)
+    {
+        return sqr(2*t.x+t.width-width) + sqr(2*t.y+t.height-height);
+    };
+    std::stable_sort(tiles.begin(), tiles.end(), [&](Tile const& a, Tile const& b){ return distSqr(a) < distSqr(b); });
+    return tiles;
+}
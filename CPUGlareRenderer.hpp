@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "TriangleKernel.hpp"
+#include "ApertureGeometry.hpp"
+#include "SpectralQuadrature.hpp"
+
+// A port of glare-shader.frag to plain C++, for use when no OpenGL 3.3 context is available.
+// The luminance it produces has the same layout as Canvas::luminanceTexture_: XYZW values,
+// row by row starting from the bottom of the image.
+class CPUGlareRenderer
+{
+public:
+    struct Wavelength
+    {
+        float wavenumber; // mm^-1
+        glm::vec4 radianceToLuminance; // already multiplied by colorScale
+    };
+    struct Parameters
+    {
+        std::shared_ptr<const ApertureGeometry> geometry;
+        float apertureRadius=1; // mm
+        float targetWidth=1000; // mm
+        int sampleCount=1;
+        TriangleKernel::Formula formula=TriangleKernel::Formula::Triangles;
+        std::vector<Wavelength> wavelengths;
+    };
+    struct Tile
+    {
+        int x, y, width, height; // px, y counted from the bottom
+    };
+
+    // Part of the keys of resumable renders. Bump it when a change to the rendering code alters
+    // the results.
+    static constexpr int version=1;
+
+    // Weight of a quadrature node for an image summed over sampleCount×sampleCount samples per pixel
+    static Wavelength wavelength(SpectralQuadrature::Node const& node, int sampleCount);
+
+    void setParameters(Parameters const& params);
+    void setImageSize(int width, int height);
+    // Accumulates all wavelengths and samples for the pixels of the tile, writing them row by
+    // row to out, where its bottom left pixel goes, with rows stride values apart. E.g. the
+    // tile goes into its place in a whole image with image+tile.y*width()+tile.x and width(),
+    // or into a buffer of its own with tile.width. Thread-safe.
+    void renderTile(Tile const& tile, glm::vec4* out, size_t stride) const;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    Parameters const& parameters() const { return params_; }
+    TriangleKernel const& kernel() const { return kernel_; }
+
+    // Splits the image into tiles of at most tileSize×tileSize, ordered by the distance
+    // of their centers from the center of the image, where the pattern is brightest
+    static std::vector<Tile> tiles(int width, int height, int tileSize);
+
+private:
+    Parameters params_;
+    TriangleKernel kernel_;
+    // Triangles formed by the origin and pairs of consecutive arc points, in mm
+    std::vector<TriangleKernel::Triangle> triangles_;
+    int width_=0, height_=0;
+};
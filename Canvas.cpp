@@ -1,29 +1,107 @@
 #include "Canvas.hpp"
 #include <cmath>
+#include <chrono>
 #include <cstring>
+#include <cstdlib>
+#include <bitset>
+#include <utility>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <QDebug>
 #include <QImage>
 #include <QPainter>
-#include <QColorSpace>
 #include <QMouseEvent>
+#include <QWheelEvent>
 #include <QMessageBox>
-#include <QImageWriter>
 #include <QFileDialog>
+#include <QElapsedTimer>
+#include <QDataStream>
+#include <QStandardPaths>
 #include <QtConcurrent>
 #include "GLSLCosineQualityChecker.hpp"
-#include "cie-xyzw-functions.hpp"
+#include "TiledCPURenderer.hpp"
+#include "SideTransformTable.hpp"
+#include "LuminanceCache.hpp"
 #include "ToolsWidget.hpp"
-#include "cie-d65.hpp"
 #include "common.hpp"
 
 namespace
 {
-QVector2D sampleShift(const float sampleNumX, const float sampleNumY, const float sampleCount)
+float radicalInverse(unsigned index, const unsigned base)
 {
-    return QVector2D(sampleNumX+0.5f, sampleNumY+0.5f)/sampleCount;
+    float result=0, digitWeight=1.f/base;
+    for(; index; index/=base, digitWeight/=base)
+        result += digitWeight*(index%base);
+    return result;
 }
+
+// Subpixel position of the sample number sampleIndex. These form a Halton sequence, so any
+// prefix of it covers the pixel evenly and more samples can be added without restarting. The
+// shift by 0.5 puts the first sample at the center of the pixel.
+QVector2D sampleShift(const int sampleIndex)
+{
+    return QVector2D(std::fmod(radicalInverse(sampleIndex, 2)+0.5f, 1.f),
+                     std::fmod(radicalInverse(sampleIndex, 3)+0.5f, 1.f));
+}
+
+// Splits the samples into two halves whose means are compared to estimate the error of adaptive
+// sampling. The split is by parity of the bits of the index (the Thue–Morse sequence): unlike
+// the odd indices, which all lie in one half of the pixel, each half then covers the whole pixel.
+bool inSecondHalf(const int sampleIndex)
+{
+    return std::bitset<32>(sampleIndex).count() % 2;
+}
+
+// The error estimate is too noisy with fewer samples than this
+constexpr int minAdaptiveSampleCount=16;
+
 template<typename T> auto sqr(T x) { return x*x; }
+float wavelengthToWavenumber(const float wavelength)
+{
+    return 2e6*M_PI / wavelength;
+}
+// Beyond it the coordinates of the pattern lose precision in the shader
+constexpr int maxZoomLevel=12;
+// Side of the tiles of progressive rendering, px. Small enough that the first ones appear
+// quickly even on slow GPUs, while the draw of an iteration stays a single one.
+constexpr int scheduleTileSize=32;
+static_assert(TilePyramid::tileSize % scheduleTileSize == 0, "Rendering tiles must subdivide those of the pyramid");
+int floorDiv(const int a, const int b)
+{
+    return a>=0 ? a/b : -((b-1-a)/b);
+}
+// GPU time per iteration of progressive rendering that the size of the scissor rect aims at
+constexpr std::chrono::milliseconds targetChunkTime(33);
+// More iterations in flight keep the GPU busy while the previous ones are displayed, fewer
+// make the response to changed settings faster
+constexpr unsigned maxChunksInFlight=3;
+// While the settings keep changing, the image is rendered at a low resolution, each frame
+// taking about this much GPU time. The full render starts once they stay put for a while.
+constexpr std::chrono::milliseconds targetLowResFrameTime(30);
+constexpr std::chrono::milliseconds interactionIdleTime(300);
+constexpr int maxLowResPixelSize=16;
+constexpr int maxLowResWavelengthCount=32;
+constexpr std::chrono::milliseconds readbackPollInterval(5);
+// Part of the luminance cache key. Bump it when a change to the rendering code alters the
+// results; changes to the glare shader invalidate the cache by themselves.
+constexpr qint32 renderingVersion=3;
+// Converts XYZ to sRGB the same way as luminanceToScreen_ shader does
+QRgb luminanceToScreen(const glm::vec4& XYZW, const float exposure)
+{
+    using namespace glm;
+    const auto XYZ2sRGBl=mat3(vec3(3.2406,-0.9689,0.0557),
+                              vec3(-1.5372,1.8758,-0.204),
+                              vec3(-0.4986,0.0415,1.057));
+    const vec3 rgb=XYZ2sRGBl*vec3(XYZW)*exposure;
+    int srgb[3];
+    for(int i=0; i<3; ++i)
+    {
+        const float clipped = std::sqrt(std::tanh(rgb[i]*rgb[i]));
+        const float c = clipped>0.0031308f ? 1.055f*std::pow(clipped, 1/2.4f)-0.055f : 12.92f*clipped;
+        srgb[i] = std::clamp(int(std::lround(255*c)), 0, 255);
+    }
+    return qRgb(srgb[0], srgb[1], srgb[2]);
+}
 }
 
 Canvas::Canvas(ToolsWidget* tools, UpdateBehavior updateBehavior, QWindow* parent)
@@ -32,6 +110,11 @@ Canvas::Canvas(ToolsWidget* tools, UpdateBehavior updateBehavior, QWindow* paren
 {
     setFormat(makeGLSurfaceFormat());
     connect(tools_, &ToolsWidget::imageSavingRequest, this, &Canvas::saveImage);
+    connect(tools_, &ToolsWidget::settingChanged, this, &Canvas::onSettingChanged);
+    interactionTimer_.setSingleShot(true);
+    interactionTimer_.setInterval(interactionIdleTime);
+    connect(&interactionTimer_, &QTimer::timeout, this, [this]{ interacting_=false; update(); });
+    connect(&imageSaving_, &QFutureWatcher<QString>::finished, this, &Canvas::onImageSaved);
 }
 
 void Canvas::setupBuffers()
@@ -54,20 +137,25 @@ void Canvas::setupBuffers()
     constexpr int coordsPerVertex=2;
     glVertexAttribPointer(attribIndex, coordsPerVertex, GL_FLOAT, false, 0, 0);
     glEnableVertexAttribArray(attribIndex);
+
+    // Quads of the tiles drawn in an iteration of progressive rendering, refilled each time
+    if(!tileVAO_)
+        glGenVertexArrays(1, &tileVAO_);
+    glBindVertexArray(tileVAO_);
+    if(!tileVBO_)
+        glGenBuffers(1, &tileVBO_);
+    glBindBuffer(GL_ARRAY_BUFFER, tileVBO_);
+    glVertexAttribPointer(attribIndex, coordsPerVertex, GL_FLOAT, false, 0, 0);
+    glEnableVertexAttribArray(attribIndex);
     glBindVertexArray(0);
 }
 
 void Canvas::setupShaders()
 {
     {
-        const char*const vertSrc = 1+R"(
-#version 330
-in vec3 vertex;
-void main()
-{
-    gl_Position=vec4(vertex,1);
-}
-)";
+        const char*const vertSrc =
+#include "glare-shader.vert"
+            ;
         if(!glareProgram_.addShaderFromSourceCode(QOpenGLShader::Vertex, vertSrc))
            QMessageBox::critical(nullptr, tr("Shader compile failure"),
                                  tr("Failed to compile %1:\n%2").arg("glare vertex shader").arg(glareProgram_.log()));
@@ -77,6 +165,30 @@ void main()
         if(!glareProgram_.link())
             QMessageBox::critical(nullptr, tr("Error linking shader program"),
                                   tr("Failed to link %1:\n%2").arg("glare shader program").arg(glareProgram_.log()));
+
+        // Looked up once instead of by name on every iteration
+        auto& u = glareUniforms_;
+        const auto location = [this](const char*const name){ return glareProgram_.uniformLocation(name); };
+        u.imageSize = location("imageSize");
+        u.targetWidth = location("targetWidth");
+        u.coordinates = location("coordinates");
+        u.wedgeStartAngle = location("wedgeStartAngle");
+        u.wedgeStep = location("wedgeStep");
+        u.apertureTriangles = location("apertureTriangles");
+        u.triangleCount = location("triangleCount");
+        u.edgeFormula = location("edgeFormula");
+        u.apertureMaxRadius = location("apertureMaxRadius");
+        u.sideTable = location("sideTable");
+        u.sideTransform = location("sideTransform");
+        u.sideTableStep = location("sideTableStep");
+        u.sideCount = location("sideCount");
+        u.sideCentroid = location("sideCentroid");
+        u.spectrum = location("spectrum");
+        u.wavelengthCount = location("wavelengthCount");
+        u.sampleShift = location("sampleShift");
+        u.secondHalf = location("secondHalf");
+        u.zoom = location("zoom");
+        u.viewOrigin = location("viewOrigin");
     }
     {
         const char*const vertSrc = 1+R"(
@@ -96,7 +208,26 @@ void main()
         const char*const fragSrc = 1+R"(
 #version 330
 uniform float exposure;
-uniform sampler2D luminanceXYZW;
+uniform sampler2D luminanceXYZW; // sum over samples
+uniform sampler2D sampleStats; // see glare-shader.frag
+uniform bool showSampleCounts;
+uniform float maxSampleCount;
+// The previous image, shown rotated and rescaled where the current one has no samples yet
+uniform bool havePreview;
+uniform sampler2D preview; // sum over samples, with mipmaps
+uniform sampler2D previewStats;
+uniform float previewRotation;
+uniform float previewRadiusRatio; // aperture radius of the preview over the current one
+uniform float previewTargetWidth; // mm
+uniform float targetWidth; // mm
+uniform vec2 imageSize;
+// The image at a low resolution, shown where neither the current one nor the preview has samples.
+// While the settings are being changed, the current image is ignored.
+uniform bool haveLowResImage;
+uniform bool lowResOnly;
+uniform sampler2D lowResImage; // sum over samples
+uniform sampler2D lowResStats;
+uniform vec2 lowResTexCoordScale; // from texCoord of the image to that of the low-res one
 in vec2 texCoord;
 out vec4 color;
 
@@ -112,7 +243,50 @@ vec3 sRGBTransferFunction(const vec3 c)
 
 void main()
 {
-    vec3 XYZ=texture(luminanceXYZW, texCoord).xyz;
+    float sampleCount=lowResOnly ? 0. : texture(sampleStats, texCoord).r;
+    if(showSampleCounts)
+    {
+        // Blue for a single sample to red for the maximum, logarithmically
+        float t=clamp(log(max(sampleCount,1.))/log(max(maxSampleCount,2.)), 0., 1.);
+        color=vec4(sRGBTransferFunction(vec3(t, 4*t*(1-t), 1-t)), 1);
+        return;
+    }
+    vec3 XYZ=sampleCount>0 ? texture(luminanceXYZW, texCoord).xyz/sampleCount : vec3(0);
+    bool covered = sampleCount>0;
+    if(!covered && havePreview)
+    {
+        // The aperture of radius R gives R⁴|F₁(R·k)|² for every wavelength, with |k| proportional to
+        // the direction sine. So the preview has the same intensity, up to the R⁴, where R times
+        // the sine is the same, in the direction rotated back to the previous angle.
+        const float distToTargetPlane = 10e3; // mm
+        vec2 posInImage = gl_FragCoord.st + 0.5 - round(imageSize/2);
+        float dist = length(posInImage);
+        float p = dist / (imageSize.x/2) * targetWidth;
+        float sine = p / sqrt(p*p + distToTargetPlane*distToTargetPlane) / previewRadiusRatio;
+        if(sine < 1)
+        {
+            float previewDist = distToTargetPlane*sine/sqrt(1-sine*sine) / previewTargetWidth * (imageSize.x/2);
+            float c = cos(previewRotation), s = sin(previewRotation);
+            vec2 posInPreview = dist>0 ? mat2(c,-s,s,c) * posInImage * (previewDist/dist) : vec2(0);
+            vec2 previewTexCoord = (posInPreview + round(imageSize/2) - 0.5) / imageSize;
+            // Derivatives are undefined in this branch, so the level of detail is chosen explicitly
+            float lod = dist>0 ? max(0., log2(previewDist/dist)) : 0.;
+            float previewCount = textureLod(previewStats, previewTexCoord, lod).r;
+            if(previewCount>0)
+            {
+                XYZ = textureLod(preview, previewTexCoord, lod).xyz/previewCount / pow(previewRadiusRatio, 4);
+                covered = true;
+            }
+        }
+    }
+    // The preview is exact where it has samples, the low-res image only approximate
+    if(!covered && haveLowResImage)
+    {
+        vec2 lowResTexCoord = texCoord*lowResTexCoordScale;
+        float lowResCount = texture(lowResStats, lowResTexCoord).r;
+        if(lowResCount>0)
+            XYZ = texture(lowResImage, lowResTexCoord).xyz/lowResCount;
+    }
     const mat3 XYZ2sRGBl=mat3(vec3(3.2406,-0.9689,0.0557),
                               vec3(-1.5372,1.8758,-0.204),
                               vec3(-0.4986,0.0415,1.057));
@@ -129,6 +303,171 @@ void main()
             QMessageBox::critical(nullptr, tr("Error linking shader program"),
                                   tr("Failed to link %1:\n%2").arg("luminance-to-sRGB shader program").arg(luminanceToScreen_.log()));
     }
+    {
+        const char*const vertSrc = 1+R"(
+#version 330
+in vec3 vertex;
+void main()
+{
+    gl_Position=vec4(vertex,1);
+}
+)";
+        if(!wedgeToImage_.addShaderFromSourceCode(QOpenGLShader::Vertex, vertSrc))
+            QMessageBox::critical(nullptr, tr("Error compiling shader"),
+                                  tr("Failed to compile %1:\n%2").arg("wedge-to-image vertex shader").arg(wedgeToImage_.log()));
+
+        const char*const fragSrc = 1+R"(
+#version 330
+uniform vec2 imageSize; // px
+uniform float wedgeAngle;
+uniform float wedgeStartAngle;
+uniform vec2 wedgeStep; // px and radians per texel
+uniform sampler2D wedge; // sum over samples
+uniform sampler2D wedgeSampleStats;
+layout(location=0) out vec4 XYZW;
+layout(location=1) out vec4 sampleStats;
+
+void main()
+{
+    // Same position as the one that glare shader averages over, given the sample shifts in [0,1]
+    vec2 posInImage = gl_FragCoord.st + 0.5 - round(imageSize/2);
+    float dist = length(posInImage);
+    // Fold the angle into the wedge: rotate by whole periods, then reflect about the mirror axis
+    float angle = mod(atan(posInImage.y, posInImage.x) - wedgeStartAngle, 2*wedgeAngle);
+    if(angle > wedgeAngle) angle = 2*wedgeAngle - angle;
+    vec2 texCoord = vec2(dist, angle) / wedgeStep / textureSize(wedge, 0);
+    // The sums are normalized by the equally interpolated counts when displayed
+    XYZW = texture(wedge, texCoord);
+    sampleStats = texture(wedgeSampleStats, texCoord);
+}
+)";
+        if(!wedgeToImage_.addShaderFromSourceCode(QOpenGLShader::Fragment, fragSrc))
+            QMessageBox::critical(nullptr, tr("Error compiling shader"),
+                                  tr("Failed to compile %1:\n%2").arg("wedge-to-image fragment shader").arg(wedgeToImage_.log()));
+        if(!wedgeToImage_.link())
+            QMessageBox::critical(nullptr, tr("Error linking shader program"),
+                                  tr("Failed to link %1:\n%2").arg("wedge-to-image shader program").arg(wedgeToImage_.log()));
+    }
+    {
+        const char*const vertSrc = 1+R"(
+#version 330
+in vec3 vertex;
+void main()
+{
+    gl_Position=vec4(vertex,1);
+}
+)";
+        if(!spectralGather_.addShaderFromSourceCode(QOpenGLShader::Vertex, vertSrc))
+            QMessageBox::critical(nullptr, tr("Error compiling shader"),
+                                  tr("Failed to compile %1:\n%2").arg("spectral gather vertex shader").arg(spectralGather_.log()));
+
+        const char*const fragSrc = 1+R"(
+#version 330
+uniform vec2 imageSize; // px
+uniform float targetWidth; // mm
+uniform vec2 sampleShift; // px
+uniform float secondHalf; // see glare-shader.frag
+uniform int wavelengthCount;
+// Two texels per wavelength: XYZW weight of |F|², and the wavenumber in x
+uniform samplerBuffer spectrum;
+// |F(k)|² in polar coordinates: x is |k|, y is the angle counted from patternStartAngle
+uniform sampler2D pattern;
+uniform vec2 patternStep; // mm^-1 and radians per texel
+uniform float patternAngle;
+uniform float patternStartAngle;
+uniform bool patternMirrored;
+layout(location=0) out vec4 XYZW;
+layout(location=1) out vec4 sampleStats;
+
+void main()
+{
+    XYZW = vec4(0);
+    const float distToTargetPlane = 10e3; // mm
+    // Same sample position and direction as in the glare shader
+    vec2 posInImage = gl_FragCoord.st - round(imageSize/2) + sampleShift;
+    vec2 pointInTargetPlane = posInImage / (imageSize.x/2) * targetWidth;
+    float directionSine = length(pointInTargetPlane) /
+                            sqrt(dot(pointInTargetPlane, pointInTargetPlane) + distToTargetPlane*distToTargetPlane);
+    float angle = atan(posInImage.y, posInImage.x) - patternStartAngle;
+    if(patternMirrored)
+    {
+        angle = mod(angle, 2*patternAngle);
+        if(angle > patternAngle) angle = 2*patternAngle - angle;
+    }
+    // Only the radius in k space depends on the wavelength
+    for(int wlIndex=0; wlIndex<wavelengthCount; ++wlIndex)
+    {
+        vec4 weight = texelFetch(spectrum, 2*wlIndex);
+        float wavenumber = texelFetch(spectrum, 2*wlIndex+1).x;
+        vec2 texCoord = vec2(wavenumber*directionSine, angle) / patternStep / textureSize(pattern, 0);
+        XYZW += weight * texture(pattern, texCoord).r;
+    }
+    sampleStats = vec4(1, secondHalf, secondHalf*XYZW.y, 0);
+}
+)";
+        if(!spectralGather_.addShaderFromSourceCode(QOpenGLShader::Fragment, fragSrc))
+            QMessageBox::critical(nullptr, tr("Error compiling shader"),
+                                  tr("Failed to compile %1:\n%2").arg("spectral gather fragment shader").arg(spectralGather_.log()));
+        if(!spectralGather_.link())
+            QMessageBox::critical(nullptr, tr("Error linking shader program"),
+                                  tr("Failed to link %1:\n%2").arg("spectral gather shader program").arg(spectralGather_.log()));
+    }
+    {
+        const char*const vertSrc = 1+R"(
+#version 330
+in vec3 vertex;
+void main()
+{
+    gl_Position=vec4(vertex,1);
+}
+)";
+        if(!convergenceMask_.addShaderFromSourceCode(QOpenGLShader::Vertex, vertSrc))
+            QMessageBox::critical(nullptr, tr("Error compiling shader"),
+                                  tr("Failed to compile %1:\n%2").arg("convergence mask vertex shader").arg(convergenceMask_.log()));
+
+        const char*const fragSrc = 1+R"(
+#version 330
+uniform sampler2D luminanceXYZW; // sum over samples
+uniform sampler2D sampleStats; // see glare-shader.frag
+uniform float tolerance; // of the relative standard error of the mean
+
+float relativeError(ivec2 texel)
+{
+    vec4 stats = texelFetch(sampleStats, texel, 0);
+    float sumY = texelFetch(luminanceXYZW, texel, 0).y;
+    float count = stats.r, countB = stats.g, countA = count - countB;
+    if(countA < 1 || countB < 1) return 1e9;
+    if(sumY <= 0) return 0;
+    // The two halves are independent estimates of the mean, so their difference gives its error
+    float meanA = (sumY - stats.b) / countA, meanB = stats.b / countB;
+    float standardError = abs(meanA - meanB) * sqrt(countA*countB) / count;
+    return standardError / (sumY / count);
+}
+
+// Writes depth, and thus stops further sampling, where the mean has converged. The depth is
+// below that of all instances of the glare shader.
+void main()
+{
+    // The estimate has a single degree of freedom, so it's taken from the neighborhood too:
+    // fringes span several pixels, while a lucky match of the halves mostly doesn't
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 maxTexel = textureSize(sampleStats, 0) - 1;
+    float error = 0;
+    for(int dy=-1; dy<=1; ++dy)
+        for(int dx=-1; dx<=1; ++dx)
+            error = max(error, relativeError(clamp(texel+ivec2(dx,dy), ivec2(0), maxTexel)));
+    if(error > tolerance)
+        discard;
+    gl_FragDepth = 0;
+}
+)";
+        if(!convergenceMask_.addShaderFromSourceCode(QOpenGLShader::Fragment, fragSrc))
+            QMessageBox::critical(nullptr, tr("Error compiling shader"),
+                                  tr("Failed to compile %1:\n%2").arg("convergence mask fragment shader").arg(convergenceMask_.log()));
+        if(!convergenceMask_.link())
+            QMessageBox::critical(nullptr, tr("Error linking shader program"),
+                                  tr("Failed to link %1:\n%2").arg("convergence mask shader program").arg(convergenceMask_.log()));
+    }
 }
 
 void Canvas::setupRenderTarget()
@@ -142,32 +481,266 @@ void Canvas::setupRenderTarget()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     if(!luminanceFBO_)
         glGenFramebuffers(1, &luminanceFBO_);
+    if(!luminanceStatsTexture_)
+        glGenTextures(1, &luminanceStatsTexture_);
+    glBindTexture(GL_TEXTURE_2D, luminanceStatsTexture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width(), height(), 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glBindFramebuffer(GL_FRAMEBUFFER, luminanceFBO_);
     glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,luminanceTexture_,0);
+    glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,luminanceStatsTexture_,0);
+    const GLenum drawBuffers[]={GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
     if(!depthRenderBuffer_)
         glGenRenderbuffers(1, &depthRenderBuffer_);
     glBindRenderbuffer(GL_RENDERBUFFER, depthRenderBuffer_);
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width(), height());
     glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,depthRenderBuffer_);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Outside of the image the preview has no samples, and thus isn't shown
+    for(const auto texture : {&previewTexture_, &previewStatsTexture_})
+    {
+        if(!*texture)
+            glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width(), height(), 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    }
+    havePreview_=false;
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-void Canvas::setupWavelengths()
+void Canvas::setupApertureTriangles()
 {
-    constexpr double min=400; // nm
-    constexpr double max=700; // nm
-    constexpr auto range=max-min;
-    const auto count=tools_->wavelengthCount();
-    wavelengths_.clear();
-    if(count > 1)
+    const auto geometry = tools_->apertureGeometry();
+    const float apertureRadius = tools_->apertureRadius();
+    if(geometry == uploadedGeometry_ && apertureRadius == uploadedApertureRadius_)
+        return;
+
+    std::vector<glm::vec4> triangles;
+    apertureMaxRadius_ = 0;
+    for(int n=0; n<geometry->triangleCount(); ++n)
+    {
+        const auto v1 = apertureRadius * geometry->triangleVertex1(n);
+        const auto v2 = apertureRadius * geometry->triangleVertex2(n);
+        triangles.emplace_back(v1.x, v1.y, v2.x, v2.y);
+        apertureMaxRadius_ = std::max(apertureMaxRadius_, glm::length(v1));
+    }
+
+    if(!apertureTrianglesBuffer_)
+        glGenBuffers(1, &apertureTrianglesBuffer_);
+    glBindBuffer(GL_TEXTURE_BUFFER, apertureTrianglesBuffer_);
+    glBufferData(GL_TEXTURE_BUFFER, triangles.size() * sizeof triangles[0], triangles.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    if(!apertureTrianglesTexture_)
+        glGenTextures(1, &apertureTrianglesTexture_);
+    glBindTexture(GL_TEXTURE_BUFFER, apertureTrianglesTexture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, apertureTrianglesBuffer_);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    uploadedGeometry_ = geometry;
+    uploadedApertureRadius_ = apertureRadius;
+}
+
+// Distance in px from the center of the image to beyond its farthest corner
+double Canvas::maxDistanceFromCenter() const
+{
+    const double centerX = std::round(width()/2.), centerY = std::round(height()/2.);
+    return std::hypot(std::max(centerX, width()-centerX), std::max(centerY, height()-centerY)) + 1;
+}
+
+// Sine of the angle from the optical axis to a point in the image at distFromCenter px
+// from its center: the wave vector there is wavenumber*directionSine in magnitude
+double Canvas::directionSine(const double distFromCenter) const
+{
+    const double targetWidth = 1000*tools_->screenWidth(); // mm
+    const double distToTargetPlane = 10e3; // mm
+    const double p = distFromCenter / (width()/2.) * targetWidth;
+    return p / std::hypot(p, distToTargetPlane);
+}
+
+Canvas::PolarMode Canvas::setupPolarTarget()
+{
+    const auto geometry = tools_->apertureGeometry();
+    const int apertureSymmetry = geometry->symmetryOrder();
+    const bool symmetric = tools_->useSymmetry() && apertureSymmetry >= 2;
+    const bool monochromatic = tools_->monochromaticPattern();
+    // The polar targets cover the whole pattern at the scale of the image
+    if((!symmetric && !monochromatic) || !defaultView())
+        return PolarMode::Off;
+    const auto mode = monochromatic ? PolarMode::MonochromaticPattern : PolarMode::ImageWedge;
+
+    polarMirrored_ = symmetric;
+    if(symmetric)
     {
-        for(int i=0;i<count;++i)
-            wavelengths_.push_back(min+range*i/(count-1));
+        // Intensity is also symmetric under k -> -k, which doubles the number of rays for odd symmetry orders
+        const int patternSymmetry = apertureSymmetry%2 ? 2*apertureSymmetry : apertureSymmetry;
+        // With the mirror symmetry, a half of the period is enough
+        polarAngle_ = M_PI / patternSymmetry;
+        polarStartAngle_ = geometry->mirrorAxisAngle();
     }
     else
     {
-            wavelengths_.push_back(610);
+        polarAngle_ = 2*M_PI;
+        // Counting the angle from the rotation of the aperture makes the texture independent of it
+        polarStartAngle_ = geometry->parameters().globalRotationAngle;
+    }
+
+    // One texel per pixel radially, as well as angularly at the corners of the image
+    const double maxDist = maxDistanceFromCenter();
+    int w = std::ceil(maxDist) + 1;
+    const int h = std::max(2, int(std::ceil(maxDist*polarAngle_)));
+    polarStep_ = QVector2D(1, polarAngle_/h);
+    if(mode == PolarMode::MonochromaticPattern)
+    {
+        // Radially the pattern is sampled in |k|. A pixel at distance r from the center sees
+        // |k| = wavenumber*directionSine(r), so the spacing of the pixels at the edge of the
+        // image, where it's the smallest, at the smallest wavenumber sets the texel size.
+        const auto [minWL, maxWL] = std::minmax_element(wavelengths_.begin(), wavelengths_.end());
+        const double maxWavenumber = wavelengthToWavenumber(*minWL);
+        const double minWavenumber = wavelengthToWavenumber(*maxWL);
+        const double step = minWavenumber * (directionSine(maxDist) - directionSine(maxDist-1));
+        const double maxK = maxWavenumber * directionSine(maxDist);
+        if(!(step > 0) || maxK/step > 1e5)
+            return PolarMode::Off;
+        w = std::ceil(maxK / step) + 1;
+        polarStep_.setX(step);
+    }
+    GLint maxTextureSize=0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    // Too fine a pattern is not worth it: rendering per wavelength is then the cheaper way
+    if(w > maxTextureSize || h > maxTextureSize)
+        return PolarMode::Off;
+
+    const GLint format = mode==PolarMode::MonochromaticPattern ? GL_R32F : GL_RGBA32F;
+    if(!polarTexture_)
+        glGenTextures(1, &polarTexture_);
+    glBindTexture(GL_TEXTURE_2D, polarTexture_);
+    if(w != polarWidth_ || h != polarHeight_ || format != polarFormat_)
+    {
+        polarWidth_ = w;
+        polarHeight_ = h;
+        polarFormat_ = format;
+        glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format==GL_R32F ? GL_RED : GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        if(!polarStatsTexture_)
+            glGenTextures(1, &polarStatsTexture_);
+        glBindTexture(GL_TEXTURE_2D, polarStatsTexture_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        if(!polarFBO_)
+            glGenFramebuffers(1, &polarFBO_);
+        glBindFramebuffer(GL_FRAMEBUFFER, polarFBO_);
+        glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,polarTexture_,0);
+        glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,polarStatsTexture_,0);
+        const GLenum drawBuffers[]={GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, drawBuffers);
+        if(!polarDepthRenderBuffer_)
+            glGenRenderbuffers(1, &polarDepthRenderBuffer_);
+        glBindRenderbuffer(GL_RENDERBUFFER, polarDepthRenderBuffer_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, w, h);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,polarDepthRenderBuffer_);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    // Clamping at the angular edges is the same as reflecting about the mirror axes,
+    // while the full circle wraps around
+    for(const auto texture : {polarTexture_, polarStatsTexture_})
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, polarMirrored_ ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return mode;
+}
+
+void Canvas::setupSpectrum()
+{
+    uploadSpectrum(wavelengths_, spectralWeights_, spectrumBuffer_, spectrumTexture_);
+}
+
+// Two texels per wavelength: XYZW weight of |F|², and the wavenumber
+void Canvas::uploadSpectrum(std::vector<float> const& wavelengths, std::vector<glm::vec4> const& weights,
+                            GLuint& buffer, GLuint& texture)
+{
+    std::vector<glm::vec4> spectrum;
+    for(unsigned wlIndex=0; wlIndex<wavelengths.size(); ++wlIndex)
+    {
+        spectrum.push_back(colorScale(wavelengths[wlIndex]) * weights[wlIndex]);
+        spectrum.emplace_back(wavelengthToWavenumber(wavelengths[wlIndex]), 0, 0, 0);
+    }
+
+    if(!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, spectrum.size() * sizeof spectrum[0], spectrum.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    if(!texture)
+        glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+bool Canvas::setupSideTable()
+{
+    const auto geometry = tools_->apertureGeometry();
+    if(!tools_->useSideTable() || geometry->symmetryOrder() < 2)
+        return false;
+
+    GLint maxTextureSize=0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    const int size = std::min(tools_->sideTableSize(), int(maxTextureSize));
+
+    SideTransformTable::Parameters params;
+    params.geometry = geometry;
+    params.apertureRadius = tools_->apertureRadius();
+    const double maxWavenumber = wavelengthToWavenumber(*std::min_element(wavelengths_.begin(), wavelengths_.end()));
+    // The margin covers the monochromatic pattern, whose k grid extends slightly beyond the image
+    params.maxWavenumber = 1.01 * maxWavenumber * directionSine(maxDistanceFromCenter());
+    params.radialSize = size;
+    params.angularSize = size;
+    if(sideTable_ && sideTable_->parameters() == params)
+        return true;
+
+    QElapsedTimer timer;
+    timer.start();
+    sideTable_ = std::make_unique<SideTransformTable>(params);
+    tools_->setSideTableStatus(sideTable_->maxInterpolationError(), timer.elapsed());
+
+    if(!sideTableTexture_)
+        glGenTextures(1, &sideTableTexture_);
+    glBindTexture(GL_TEXTURE_2D, sideTableTexture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size, size, 0, GL_RG, GL_FLOAT, sideTable_->data().data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    // The angle wraps around
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+void Canvas::setupWavelengths()
+{
+    const auto& nodes = spectralQuadrature_.nodes(*tools_->sourceSpectrum(), tools_->spectralRule(),
+                                                  tools_->wavelengthCount());
+    wavelengths_.clear();
+    spectralWeights_.clear();
+    for(const auto& node : nodes)
+    {
+        wavelengths_.push_back(node.wavelength);
+        spectralWeights_.push_back(node.weight);
     }
 }
 
@@ -175,9 +748,14 @@ void Canvas::initializeGL()
 {
     if(!initializeOpenGLFunctions())
     {
-        QMessageBox::critical(nullptr, tr("Error initializing OpenGL"), tr("Failed to initialize OpenGL %1.%2 functions")
-                                    .arg(OPENGL_MAJOR_VERSION)
-                                    .arg(OPENGL_MINOR_VERSION));
+        qWarning().nospace() << "Failed to initialize OpenGL " << OPENGL_MAJOR_VERSION << "." << OPENGL_MINOR_VERSION
+                             << " functions, falling back to rendering on the CPU";
+        cpuRenderer_ = std::make_unique<TiledCPURenderer>();
+        connect(cpuRenderer_.get(), &TiledCPURenderer::progressed, this, qOverload<>(&Canvas::update));
+        connect(cpuRenderer_.get(), &TiledCPURenderer::finished, this, qOverload<>(&Canvas::update));
+        connect(cpuRenderer_.get(), &TiledCPURenderer::finished, this,
+                [this]{ emit renderStatusChanged(cpuRenderer_->status()); });
+        setupWavelengths();
         return;
     }
 
@@ -187,224 +765,1378 @@ void Canvas::initializeGL()
 #include "glare-shader.frag"
         ;
     glareFragShader.replace("COSINE_IS_BROKEN", cosineIsOK ? "0" : "1");
+    glareFragShader.replace("WAVELENGTH_BATCH_SIZE", QByteArray::number(wavelengthBatchSize));
 
     setupBuffers();
     setupRenderTarget();
     setupShaders();
     setupWavelengths();
+    setupLuminanceCache();
+    setupTileAtlas();
+    profiler_.setDevice(QString("%1, OpenGL %2").arg(reinterpret_cast<const char*>(glGetString(GL_RENDERER)),
+                                                     reinterpret_cast<const char*>(glGetString(GL_VERSION))));
+}
 
-    glFinish();
+void Canvas::setupLuminanceCache()
+{
+    qint64 maxMegabytes=1024;
+    if(const char*const limit=std::getenv("APERDIFF_CACHE_LIMIT_MB"))
+        maxMegabytes=std::atoll(limit);
+    if(maxMegabytes<=0)
+        return;
+    const auto dir=QStandardPaths::writableLocation(QStandardPaths::CacheLocation)+"/luminance";
+    luminanceCache_=std::make_unique<LuminanceCache>(dir, maxMegabytes*1024*1024);
 }
 
-Canvas::~Canvas()
+// Everything the finished tiles of the pattern depend on: unlike the whole image, they don't
+// depend on the height of the image and on the view. The width sets the scale of the pattern.
+QByteArray Canvas::tileKey() const
 {
-    makeCurrent();
-    if(luminanceFBO_)
-        glDeleteFramebuffers(1, &luminanceFBO_);
-    if(luminanceTexture_)
-        glDeleteTextures(1, &luminanceTexture_);
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << renderingVersion << glareFragShader << width()
+           << tools_->pointCount() << tools_->arcPointCount() << tools_->apertureRadius()
+           << tools_->curvatureRadius() << tools_->globalRotationAngle() << tools_->screenWidth()
+           << tools_->sampleCount() << tools_->wavelengthCount()
+           << int(tools_->spectralRule()) << tools_->sourceSpectrum()->key()
+           << tools_->useSymmetry() << tools_->monochromaticPattern() << tools_->useEdgeFormula()
+           << tools_->useSideTable() << (tools_->useSideTable() ? tools_->sideTableSize() : 0)
+           << tools_->adaptiveSampling() << (tools_->adaptiveSampling() ? tools_->samplingTolerance() : 0.);
+    return key;
 }
 
-QVector4D Canvas::radianceToLuminance(const unsigned texIndex) const
+// Everything the finished luminance image depends on
+QByteArray Canvas::renderKey() const
 {
-    if(wavelengths_.size() == 1)
-    {
-        const auto ret = 4000.f * wavelengthToXYZW(wavelengths_[texIndex]);
-        return QVector4D(ret.x, ret.y, ret.z, ret.w);
-    }
-    const auto wlCount = wavelengths_.size();
-    // Weight for the trapezoidal quadrature rule
-    const float weight = texIndex==0 || texIndex==wlCount-1 ? 0.5 : 1;
-    const float dlambda = weight * std::abs(wavelengths_.back()-wavelengths_.front()) / (wlCount-1.f);
-    const float wl = wavelengths_[texIndex];
-    const auto ret = illuminantD65(wl) * wavelengthToXYZW(wl) * dlambda;
-    return QVector4D(ret.x, ret.y, ret.z, ret.w);
+    QByteArray key = tileKey();
+    QDataStream stream(&key, QIODevice::WriteOnly|QIODevice::Append);
+    stream << height() << zoomLevel_ << viewOffset_;
+    return key;
 }
 
-void Canvas::paintGL()
+QString Canvas::renderDescription() const
 {
-    if(!isVisible() || width()==0 || height()==0) return;
+    return QString("%1x%2 px, %3 points, %4 arc points, %5 wavelengths, %6x%6 samples, %7 formula, %8")
+            .arg(width()).arg(height()).arg(tools_->pointCount()).arg(tools_->arcPointCount())
+            .arg(wavelengths_.size()).arg(tools_->sampleCount())
+            .arg(tools_->useEdgeFormula() ? "edge" : "triangle")
+            .arg(polarMode_==PolarMode::MonochromaticPattern ? "monochromatic pattern" :
+                 polarMode_==PolarMode::ImageWedge ? "symmetric wedge" : "direct");
+}
 
-    if(width()!=lastWidth_ || height()!=lastHeight_)
-    {
-        needRedraw_=true;
-        // NOTE: we don't use QOpenGLWindow::resizeGL(), because it's sometimes called _after_
-        // QOpenGLWindow::paintGL() instead of before. This breaks rendering until subsequent
-        // repaint, which doesn't happen if nothing triggers it.
-        lastWidth_=width();
-        lastHeight_=height();
-        setupRenderTarget();
-    }
+bool Canvas::loadFromCache()
+{
+    renderKey_=renderKey();
+    if(!luminanceCache_)
+        return false;
+    const auto image=luminanceCache_->find(renderKey_, width(), height());
+    if(!image)
+        return false;
+    glBindTexture(GL_TEXTURE_2D, luminanceTexture_);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width(), height(), GL_RGBA, GL_FLOAT, image->data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    // The cached image is already normalized
+    GLint oldFBO=-1;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, luminanceFBO_);
+    const GLfloat one[4]={1,0,0,0};
+    glClearBufferfv(GL_COLOR, 1, one);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oldFBO);
+    refinable_=false;
+    return true;
+}
 
-    if(prevWavelengthCount_!=tools_->wavelengthCount())
-        setupWavelengths();
+// The cache is best effort: a finished image is skipped while the previous one is still being stored
+void Canvas::storeInCache()
+{
+    if(!luminanceCache_ || cacheReadback_.buffer || cacheStoring_.isRunning())
+        return;
+    cacheKey_=renderKey_;
+    startReadback(cacheReadback_);
+    QTimer::singleShot(0, this, &Canvas::finishCacheReadback);
+}
 
-    if(prevPointCount_!=tools_->pointCount() || prevArcPointCount_!=tools_->arcPointCount() ||
-       prevApertureRadius_!=tools_->apertureRadius() ||
-       prevCurvatureRadius_!=tools_->curvatureRadius() || prevScreenWidth_!=tools_->screenWidth() ||
-       prevSampleCount_!=tools_->sampleCount() || prevWavelengthCount_!=tools_->wavelengthCount() ||
-       prevRotationAngle_!=tools_->globalRotationAngle())
+// Polls the readback started by storeInCache(). Once it's done, a worker thread averages the
+// samples and writes the cache entry.
+void Canvas::finishCacheReadback()
+{
+    if(!cacheReadback_.buffer)
+        return;
+    makeCurrent();
+    if(!readbackFinished(cacheReadback_))
     {
-        needRedraw_=true;
-        prevScreenWidth_=tools_->screenWidth();
-        prevRotationAngle_=tools_->globalRotationAngle();
-        prevArcPointCount_=tools_->arcPointCount();
-        prevApertureRadius_=tools_->apertureRadius();
-        prevCurvatureRadius_=tools_->curvatureRadius();
-        prevPointCount_=tools_->pointCount();
-        prevSampleCount_=tools_->sampleCount();
-        prevWavelengthCount_=tools_->wavelengthCount();
+        doneCurrent();
+        QTimer::singleShot(readbackPollInterval, this, &Canvas::finishCacheReadback);
+        return;
+    }
+    const auto sums = mapReadback(cacheReadback_);
+    doneCurrent();
+    if(!sums)
+    {
+        qWarning() << "Failed to map the pixel buffer of the image to cache";
+        releaseReadback(cacheReadback_);
+        return;
     }
 
-    glViewport(0, 0, width(), height());
-    glBindVertexArray(vao_);
-
-    if(needRedraw_ || drawingInProgress_)
+    const auto size = cacheReadback_.size();
+    cacheStoring_ = QtConcurrent::run([this, sums, size, cache=luminanceCache_.get(), key=cacheKey_,
+                                       w=cacheReadback_.width, h=cacheReadback_.height]
     {
-        GLint targetFBO=-1;
-        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+        const auto data = averageSamples(sums, reinterpret_cast<const float*>(sums+size), size);
+        QMetaObject::invokeMethod(this, [this]{ releaseReadback(cacheReadback_); }, Qt::QueuedConnection);
+        cache->insert(key, w, h, data.data());
+    });
+}
 
-        glBindFramebuffer(GL_FRAMEBUFFER,luminanceFBO_);
+void Canvas::startReadback(LuminanceReadback& readback)
+{
+    readback.width = width();
+    readback.height = height();
+    const size_t size = readback.size();
+    glGenBuffers(1, &readback.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size*(sizeof(glm::vec4)+sizeof(float)), nullptr, GL_STREAM_READ);
+    GLint oldFBO=-1;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &oldFBO);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, luminanceFBO_);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, readback.width, readback.height, GL_RGBA, GL_FLOAT, nullptr);
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glReadPixels(0, 0, readback.width, readback.height, GL_RED, GL_FLOAT, reinterpret_cast<void*>(size*sizeof(glm::vec4)));
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, oldFBO);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+}
 
-        if(needRedraw_)
-        {
-            glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-            drawingInProgress_=true;
-            prevRenderArea_=0;
-            prevScissorHeight_=0;
-            renderAreaPerIteration_=50;
-        }
+bool Canvas::readbackFinished(LuminanceReadback& readback)
+{
+    if(glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+        return false;
+    glDeleteSync(readback.fence);
+    readback.fence=nullptr;
+    return true;
+}
 
-        const auto time0=std::chrono::steady_clock::now();
+const glm::vec4* Canvas::mapReadback(LuminanceReadback& readback)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    const auto sums = static_cast<const glm::vec4*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                                     readback.size()*(sizeof(glm::vec4)+sizeof(float)),
+                                                                     GL_MAP_READ_BIT));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.mapped = sums != nullptr;
+    return sums;
+}
 
-        const auto aspectRatio = double(width())/height();
-        int scissorRectHeight = std::ceil(std::sqrt((renderAreaPerIteration_ + prevRenderArea_) / aspectRatio));
-        if(scissorRectHeight == prevScissorHeight_)
-            ++scissorRectHeight;
-        const int scissorRectWidth = scissorRectHeight*aspectRatio;
-        const int scissorRectX = ( width()-scissorRectWidth )/2;
-        const int scissorRectY = (height()-scissorRectHeight)/2;
-        glScissor(scissorRectX, scissorRectY, scissorRectWidth, scissorRectHeight);
-        glEnable(GL_SCISSOR_TEST);
-
-        glEnable(GL_DEPTH_TEST);
-        glBlendFunc(GL_ONE, GL_ONE);
-        glareProgram_.bind();
-        const int sampleCount = tools_->sampleCount();
-
-        glareProgram_.setUniformValue("imageSize", QVector2D(width(), height()));
-        glareProgram_.setUniformValue("targetWidth", float(1000*tools_->screenWidth()));
-        glareProgram_.setUniformValue("pointCount", tools_->pointCount());
-        glareProgram_.setUniformValue("arcPointCount", tools_->arcPointCount());
-        glareProgram_.setUniformValue("curvatureRadius", float(tools_->curvatureRadius()));
-        glareProgram_.setUniformValue("apertureRadius", float(tools_->apertureRadius()));
-        glareProgram_.setUniformValue("globalRotationAngle", float(tools_->globalRotationAngle()));
-
-        for(unsigned wlIndex=0; wlIndex<wavelengths_.size(); ++wlIndex)
-        {
-            const float wavenumber = 2e6*M_PI / wavelengths_[wlIndex];
-            constexpr float wavenumberBase = 2e6*M_PI/555;
-
-            // Properly weigh according to the large-z asymptotics of the field
-            // \int F(k_x,k_y)*exp(i(k_x*x+k_y*y+z*\sqrt{|k|^2-k_x^2-k_y^2})) dk_x dk_y
-            //
-            // The field is proportional to k, but we use the ratio of k to that
-            // of the 555nm light to avoid having to alter exposure.
-            float colorScale = sqr(wavenumber / wavenumberBase);
-            colorScale /= sqr(sampleCount);
-
-            glareProgram_.setUniformValue("wavenumber", wavenumber);
-            glareProgram_.setUniformValue("colorScale", colorScale);
-            glareProgram_.setUniformValue("radianceToLuminance", radianceToLuminance(wlIndex));
-
-            for(int sampleNumY=0; sampleNumY<sampleCount; ++sampleNumY)
-            {
-                for(int sampleNumX=0; sampleNumX<sampleCount; ++sampleNumX)
-                {
-                    glareProgram_.setUniformValue("sampleShift", sampleShift(sampleNumX, sampleNumY, sampleCount));
-
-                    if(wlIndex==0 && sampleNumX==0 && sampleNumY==0)
-                        glDisable(GL_BLEND);
-                    else
-                        glEnable(GL_BLEND);
-
-                    // Only the last iteration updates the depth buffer
-                    glDepthMask(wlIndex+1 == wavelengths_.size() && sampleNumY+1 == sampleCount && sampleNumX+1 == sampleCount);
-                    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-                }
-            }
-        }
-        glDisable(GL_BLEND);
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_SCISSOR_TEST);
-        glScissor(0, 0, width(), height());
+void Canvas::releaseReadback(LuminanceReadback& readback)
+{
+    if(!readback.buffer)
+        return;
+    makeCurrent();
+    if(readback.fence)
+        glDeleteSync(readback.fence);
+    readback.fence=nullptr;
+    if(readback.mapped)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback.mapped=false;
+    }
+    glDeleteBuffers(1, &readback.buffer);
+    readback.buffer=0;
+    doneCurrent();
+}
 
-        glFinish();
-        const auto time1=std::chrono::steady_clock::now();
+QPoint Canvas::viewOrigin() const
+{
+    return viewOffset_ - QPoint(std::round(width()/2.), std::round(height()/2.));
+}
 
-        prevScissorHeight_ = scissorRectHeight;
-        prevRenderArea_ = scissorRectHeight*scissorRectWidth;
+std::vector<std::pair<TilePyramid::TileID, QRect>> Canvas::visibleTiles() const
+{
+    constexpr int size = TilePyramid::tileSize;
+    const auto origin = viewOrigin();
+    std::vector<std::pair<TilePyramid::TileID, QRect>> tiles;
+    for(int y=floorDiv(origin.y(), size); y<=floorDiv(origin.y()+height()-1, size); ++y)
+        for(int x=floorDiv(origin.x(), size); x<=floorDiv(origin.x()+width()-1, size); ++x)
+            tiles.push_back({{zoomLevel_, x, y}, QRect(x*size-origin.x(), y*size-origin.y(), size, size)});
+    return tiles;
+}
+
+QPoint Canvas::atlasSlotCorner(const int slot) const
+{
+    return QPoint(slot%atlasSlotsPerSide_, slot/atlasSlotsPerSide_) * TilePyramid::tileSize;
+}
 
-        if(time1 - time0 < std::chrono::milliseconds(250))
-            renderAreaPerIteration_ *= 2;
+void Canvas::setupTileAtlas()
+{
+    GLint maxTextureSize=0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    // 16x16 tiles take 128 MiB with the statistics
+    atlasSlotsPerSide_ = std::min(16, maxTextureSize/TilePyramid::tileSize);
+    const int size = atlasSlotsPerSide_*TilePyramid::tileSize;
+    for(const auto texture : {&tileAtlasTexture_, &tileAtlasStatsTexture_})
+    {
+        glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &tileAtlasFBO_);
+    glBindFramebuffer(GL_FRAMEBUFFER, tileAtlasFBO_);
+    glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,tileAtlasTexture_,0);
+    glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,tileAtlasStatsTexture_,0);
+    const GLenum drawBuffers[]={GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    tilePyramid_ = std::make_unique<TilePyramid>(sqr(atlasSlotsPerSide_));
+}
 
-        if(scissorRectX <= 0 && scissorRectY <= 0 && scissorRectWidth >= width() && scissorRectHeight >= height())
+void Canvas::copyAttachments(const GLuint srcFBO, QRect const& srcRect, const GLuint dstFBO, QPoint const& dstPos)
+{
+    GLint oldReadFBO=-1, oldDrawFBO=-1;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &oldReadFBO);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldDrawFBO);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, srcFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dstFBO);
+    for(const GLenum attachment : {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1})
+    {
+        glReadBuffer(attachment);
+        glDrawBuffer(attachment);
+        glBlitFramebuffer(srcRect.x(), srcRect.y(), srcRect.x()+srcRect.width(), srcRect.y()+srcRect.height(),
+                          dstPos.x(), dstPos.y(), dstPos.x()+srcRect.width(), dstPos.y()+srcRect.height(),
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    const GLenum drawBuffers[]={GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, oldReadFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oldDrawFBO);
+}
+
+// Copies the finished tiles of the current view from the atlas, including those partially
+// visible. The rendering tiles inside them are then skipped in all passes.
+void Canvas::restoreCachedTiles()
+{
+    restoredTileRects_.clear();
+    if(!tilePyramid_ || polarMode_ != PolarMode::Off)
+        return;
+    tilePyramid_->setKey(tileKey());
+    for(const auto& [id, rect] : visibleTiles())
+    {
+        const int slot = tilePyramid_->find(id);
+        if(slot < 0)
+            continue;
+        copyAttachments(tileAtlasFBO_, QRect(atlasSlotCorner(slot), rect.size()), luminanceFBO_, rect.topLeft());
+        restoredTileRects_.push_back(rect);
+    }
+}
+
+// Keeps the tiles of the finished image that lie wholly inside it and aren't in the atlas yet
+void Canvas::storeFinishedTiles()
+{
+    if(!tilePyramid_ || polarMode_ != PolarMode::Off)
+        return;
+    tilePyramid_->setKey(tileKey());
+    const QRect image(0, 0, width(), height());
+    for(const auto& [id, rect] : visibleTiles())
+    {
+        if(!image.contains(rect) || tilePyramid_->find(id) >= 0)
+            continue;
+        copyAttachments(luminanceFBO_, rect, tileAtlasFBO_, atlasSlotCorner(tilePyramid_->insert(id)));
+    }
+}
+
+Canvas::~Canvas()
+{
+    // The workers may still be reading the mapped pixel buffers
+    imageSaving_.waitForFinished();
+    cacheStoring_.waitForFinished();
+    releaseReadback(imageReadback_);
+    releaseReadback(cacheReadback_);
+    makeCurrent();
+    if(luminanceFBO_)
+        glDeleteFramebuffers(1, &luminanceFBO_);
+    if(luminanceTexture_)
+        glDeleteTextures(1, &luminanceTexture_);
+    if(luminanceStatsTexture_)
+        glDeleteTextures(1, &luminanceStatsTexture_);
+    if(apertureTrianglesTexture_)
+        glDeleteTextures(1, &apertureTrianglesTexture_);
+    if(polarFBO_)
+        glDeleteFramebuffers(1, &polarFBO_);
+    if(polarTexture_)
+        glDeleteTextures(1, &polarTexture_);
+    if(polarStatsTexture_)
+        glDeleteTextures(1, &polarStatsTexture_);
+    if(polarDepthRenderBuffer_)
+        glDeleteRenderbuffers(1, &polarDepthRenderBuffer_);
+    if(maskFBO_)
+        glDeleteFramebuffers(1, &maskFBO_);
+    if(spectrumTexture_)
+        glDeleteTextures(1, &spectrumTexture_);
+    if(previewTexture_)
+        glDeleteTextures(1, &previewTexture_);
+    if(previewStatsTexture_)
+        glDeleteTextures(1, &previewStatsTexture_);
+    if(spectrumBuffer_)
+        glDeleteBuffers(1, &spectrumBuffer_);
+    if(sideTableTexture_)
+        glDeleteTextures(1, &sideTableTexture_);
+    if(apertureTrianglesBuffer_)
+        glDeleteBuffers(1, &apertureTrianglesBuffer_);
+    if(tileAtlasFBO_)
+        glDeleteFramebuffers(1, &tileAtlasFBO_);
+    if(tileAtlasTexture_)
+        glDeleteTextures(1, &tileAtlasTexture_);
+    if(tileAtlasStatsTexture_)
+        glDeleteTextures(1, &tileAtlasStatsTexture_);
+    if(lowResFBO_)
+        glDeleteFramebuffers(1, &lowResFBO_);
+    if(lowResTexture_)
+        glDeleteTextures(1, &lowResTexture_);
+    if(lowResStatsTexture_)
+        glDeleteTextures(1, &lowResStatsTexture_);
+    if(lowResSpectrumTexture_)
+        glDeleteTextures(1, &lowResSpectrumTexture_);
+    if(lowResSpectrumBuffer_)
+        glDeleteBuffers(1, &lowResSpectrumBuffer_);
+    if(lowResTimeQuery_)
+        glDeleteQueries(1, &lowResTimeQuery_);
+    dropChunkTimings();
+    if(!freeTimeQueries_.empty())
+        glDeleteQueries(freeTimeQueries_.size(), freeTimeQueries_.data());
+}
+
+float Canvas::colorScale(const float wavelength) const
+{
+    const float wavenumber = wavelengthToWavenumber(wavelength);
+    const float wavenumberBase = wavelengthToWavenumber(555);
+
+    // Properly weigh according to the large-z asymptotics of the field
+    // \int F(k_x,k_y)*exp(i(k_x*x+k_y*y+z*\sqrt{|k|^2-k_x^2-k_y^2})) dk_x dk_y
+    //
+    // The field is proportional to k, but we use the ratio of k to that
+    // of the 555nm light to avoid having to alter exposure.
+    // The average over samples is taken when the image is displayed.
+    return sqr(wavenumber / wavenumberBase);
+}
+
+void Canvas::checkSettings()
+{
+    if(prevWavelengthCount_!=tools_->wavelengthCount() || prevSpectralRule_!=tools_->spectralRule() ||
+       prevSourceSpectrum_!=tools_->sourceSpectrum())
+        setupWavelengths();
+
+    // Changes other than of rotation, scale and sample count
+    const bool imageChanged =
+       prevPointCount_!=tools_->pointCount() || prevArcPointCount_!=tools_->arcPointCount() ||
+       prevCurvatureRadius_!=tools_->curvatureRadius() || prevWavelengthCount_!=tools_->wavelengthCount() || prevSpectralRule_!=tools_->spectralRule() ||
+       prevSourceSpectrum_!=tools_->sourceSpectrum() || prevUseSymmetry_!=tools_->useSymmetry() ||
+       prevMonochromaticPattern_!=tools_->monochromaticPattern() ||
+       prevUseEdgeFormula_!=tools_->useEdgeFormula() || prevUseSideTable_!=tools_->useSideTable() ||
+       prevSideTableSize_!=tools_->sideTableSize() || prevAdaptiveSampling_!=tools_->adaptiveSampling() ||
+       prevSamplingTolerance_!=tools_->samplingTolerance() ||
+       prevZoomLevel_!=zoomLevel_ || prevViewOffset_!=viewOffset_;
+    const bool rotationChanged = prevRotationAngle_!=tools_->globalRotationAngle();
+    // The pattern only scales with the size of the aperture and of the screen
+    const bool scaleChanged = prevApertureRadius_!=tools_->apertureRadius() || prevScreenWidth_!=tools_->screenWidth();
+    const bool sampleCountChanged = prevSampleCount_!=tools_->sampleCount();
+    if(imageChanged || rotationChanged || scaleChanged || sampleCountChanged)
+    {
+        // The render targets hold the sums of the current render. The restored tiles already
+        // have all the samples, so the pass in progress would give them some of them twice.
+        const bool continuable = refinable_ && !needRedraw_ && !cpuRenderer_ &&
+                                 (restoredTileRects_.empty() || !drawingInProgress_);
+        if(!imageChanged && !rotationChanged && !scaleChanged && tools_->sampleCount() > prevSampleCount_ && continuable)
+        {
+            // The samples already summed are a prefix of the larger set, so just keep adding
+            renderKey_=renderKey();
+            restoredTileRects_.clear();
+            if(!drawingInProgress_)
+            {
+                drawingInProgress_=true;
+                resumeSampling_=true;
+                profiler_.startRender(renderDescription()+", refining", sqr(tools_->sampleCount()));
+            }
+        }
+        else if(!imageChanged && !scaleChanged && !sampleCountChanged && continuable && polarMode_ != PolarMode::Off)
+        {
+            rotatePolarTarget();
+        }
+        else
+        {
+            // The preview is rotated and scaled about the center of the pattern. While a redraw is
+            // pending, e.g. during a drag of a slider, the one kept at the start of the change
+            // still applies, as the shader maps it from its own settings.
+            if(!imageChanged && !cpuRenderer_ && defaultView())
+            {
+                if(!needRedraw_)
+                    keepPreview();
+            }
+            else
+                havePreview_=false;
+            needRedraw_=true;
+        }
+        prevScreenWidth_=tools_->screenWidth();
+        prevRotationAngle_=tools_->globalRotationAngle();
+        prevArcPointCount_=tools_->arcPointCount();
+        prevApertureRadius_=tools_->apertureRadius();
+        prevCurvatureRadius_=tools_->curvatureRadius();
+        prevPointCount_=tools_->pointCount();
+        prevSampleCount_=tools_->sampleCount();
+        prevWavelengthCount_=tools_->wavelengthCount();
+        prevSpectralRule_=tools_->spectralRule();
+        prevSourceSpectrum_=tools_->sourceSpectrum();
+        prevUseSymmetry_=tools_->useSymmetry();
+        prevMonochromaticPattern_=tools_->monochromaticPattern();
+        prevUseEdgeFormula_=tools_->useEdgeFormula();
+        prevUseSideTable_=tools_->useSideTable();
+        prevSideTableSize_=tools_->sideTableSize();
+        prevAdaptiveSampling_=tools_->adaptiveSampling();
+        prevSamplingTolerance_=tools_->samplingTolerance();
+        prevZoomLevel_=zoomLevel_;
+        prevViewOffset_=viewOffset_;
+    }
+}
+
+CPUGlareRenderer::Parameters Canvas::cpuRendererParameters() const
+{
+    CPUGlareRenderer::Parameters params;
+    params.geometry = tools_->apertureGeometry();
+    params.apertureRadius = tools_->apertureRadius();
+    params.targetWidth = 1000*tools_->screenWidth();
+    params.sampleCount = tools_->sampleCount();
+    params.formula = tools_->useEdgeFormula() ? TriangleKernel::Formula::Edges : TriangleKernel::Formula::Triangles;
+    // The CPU renderer sums its grid of samples directly into the image
+    for(unsigned wlIndex=0; wlIndex<wavelengths_.size(); ++wlIndex)
+        params.wavelengths.push_back(CPUGlareRenderer::wavelength({wavelengths_[wlIndex], spectralWeights_[wlIndex]},
+                                                                  tools_->sampleCount()));
+    return params;
+}
+
+void Canvas::paintWithCPU()
+{
+    if(width()!=lastWidth_ || height()!=lastHeight_)
+    {
+        needRedraw_=true;
+        lastWidth_=width();
+        lastHeight_=height();
+    }
+    checkSettings();
+
+    if(needRedraw_)
+    {
+        cpuRenderer_->start(cpuRendererParameters(), width(), height());
+        needRedraw_=false;
+    }
+
+    const float exposure = std::pow(10., tools_->exposure());
+    const int w = cpuRenderer_->width(), h = cpuRenderer_->height();
+    const auto luminance = cpuRenderer_->luminance();
+    QImage image(w, h, QImage::Format_RGB32);
+    for(int y=0; y<h; ++y)
+    {
+        // The luminance buffer starts from the bottom row, like an OpenGL texture
+        const auto line = reinterpret_cast<QRgb*>(image.scanLine(h-1-y));
+        for(int x=0; x<w; ++x)
+            line[x] = luminanceToScreen(luminance[size_t(y)*w+x], exposure);
+    }
+    QPainter painter(this);
+    painter.drawImage(QRect(0,0,width(),height()), image);
+}
+
+void Canvas::resetProgressiveRendering()
+{
+    renderAreaPerIteration_=50;
+    setupTileGrid();
+    resetTilePass();
+}
+
+// Splits the current render target into the tiles of progressive rendering. In the image they're
+// aligned to the tiles of the pyramid, so that each of them is either restored or rendered whole.
+void Canvas::setupTileGrid()
+{
+    const bool polar = polarMode_ != PolarMode::Off && !gatheringSpectrum_;
+    const QRect target(0, 0, polar ? polarWidth_ : width(), polar ? polarHeight_ : height());
+    const QPoint origin = polar ? QPoint() : viewOrigin();
+    constexpr int size = scheduleTileSize;
+    const int startX = floorDiv(origin.x(), size)*size - origin.x();
+    const int startY = floorDiv(origin.y(), size)*size - origin.y();
+    tileRects_.clear();
+    for(int y=startY; y<target.height(); y+=size)
+        for(int x=startX; x<target.width(); x+=size)
+            tileRects_.push_back(QRect(x, y, size, size) & target);
+    tileDone_.assign(tileRects_.size(), false);
+}
+
+// Starts a pass of the current sample over the tiles of the target
+void Canvas::resetTilePass()
+{
+    for(size_t n=0; n<tileRects_.size(); ++n)
+    {
+        // The restored tiles already have all the samples
+        tileDone_[n] = std::any_of(restoredTileRects_.begin(), restoredTileRects_.end(),
+                                   [&](QRect const& rect){ return rect.contains(tileRects_[n]); });
+    }
+    tileOrderStale_=true;
+}
+
+// Smaller values go first: the image is rendered from the cursor, if it's over the window, or
+// else from the center of the pattern out; the polar targets from the center out
+float Canvas::tilePriority(QRect const& tile) const
+{
+    const auto center = QRectF(tile).center();
+    if(polarMode_ != PolarMode::Off && !gatheringSpectrum_)
+        return center.x();
+    const auto origin = viewOrigin();
+    const QPointF focus = cursorInside_ ? QPointF(cursorPos_) :
+                                          QPointF(std::clamp(-origin.x(), 0, width()), std::clamp(-origin.y(), 0, height()));
+    const auto offset = center - focus;
+    return QPointF::dotProduct(offset, offset);
+}
+
+// Takes the most important tiles not yet done in this pass, about renderAreaPerIteration_ px of them
+std::vector<QRect> Canvas::nextTiles()
+{
+    if(tileOrderStale_)
+    {
+        pendingTiles_.clear();
+        for(int n=0; n<int(tileRects_.size()); ++n)
+            if(!tileDone_[n])
+                pendingTiles_.push_back(n);
+        // The most important one goes last, to be taken first
+        std::sort(pendingTiles_.begin(), pendingTiles_.end(), [this](const int a, const int b)
+                  { return tilePriority(tileRects_[a]) > tilePriority(tileRects_[b]); });
+        tileOrderStale_=false;
+    }
+    std::vector<QRect> tiles;
+    lastIterationArea_=0;
+    while(!pendingTiles_.empty() && (tiles.empty() || lastIterationArea_ < renderAreaPerIteration_))
+    {
+        const int n = pendingTiles_.back();
+        pendingTiles_.pop_back();
+        tileDone_[n]=true;
+        tiles.push_back(tileRects_[n]);
+        lastIterationArea_ += tileRects_[n].width()*tileRects_[n].height();
+    }
+    return tiles;
+}
+
+// Draws the quads of the tiles, given in px of a target of the given size, instanceCount times
+void Canvas::drawTiles(std::vector<QRect> const& tiles, const int targetWidth, const int targetHeight,
+                       const int instanceCount)
+{
+    std::vector<GLfloat> vertices;
+    vertices.reserve(tiles.size()*12);
+    for(const auto& tile : tiles)
+    {
+        const float left   = 2.f*tile.x()/targetWidth-1,  right = 2.f*(tile.x()+tile.width())/targetWidth-1;
+        const float bottom = 2.f*tile.y()/targetHeight-1, top   = 2.f*(tile.y()+tile.height())/targetHeight-1;
+        vertices.insert(vertices.end(), {left,bottom, right,bottom, left,top,
+                                         left,top,    right,bottom, right,top});
+    }
+    glBindVertexArray(tileVAO_);
+    glBindBuffer(GL_ARRAY_BUFFER, tileVBO_);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof vertices[0], vertices.data(), GL_STREAM_DRAW);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, vertices.size()/2, instanceCount);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(vao_);
+}
+
+// Drops the work on the current image once a setting makes it obsolete. What has already been
+// submitted to the GPU can't be recalled, which is why only a few iterations are kept in flight.
+void Canvas::cancelRendering()
+{
+    pendingTiles_.clear();
+    tileOrderStale_=true;
+    dropChunkTimings();
+}
+
+// Called right when a setting changes, e.g. on every step of a dragged slider, so that the
+// obsolete image doesn't get another iteration before the repaint. The switch to the low-res
+// image is left to paintGL(), which sees all the changes since the last frame.
+void Canvas::onSettingChanged()
+{
+    if(cpuRenderer_)
+    {
+        checkSettings();
+        if(needRedraw_)
+            cpuRenderer_->cancel();
+        return;
+    }
+    settingsChangedByUser_=true;
+    if(!isValid())
+        return;
+    makeCurrent();
+    checkSettings();
+    if(needRedraw_)
+        cancelRendering();
+    doneCurrent();
+}
+
+// Reads the GPU time of the finished iterations, waiting for the oldest ones while more than
+// maxInFlight remain, and sizes the next iterations to take targetChunkTime each
+void Canvas::collectChunkTimings(const unsigned maxInFlight)
+{
+    while(!chunksInFlight_.empty())
+    {
+        const auto chunk = chunksInFlight_.front();
+        const bool mustWait = chunksInFlight_.size() > maxInFlight;
+        GLenum status;
+        do status = glClientWaitSync(chunk.fence, GL_SYNC_FLUSH_COMMANDS_BIT, mustWait ? 1'000'000'000 : 0);
+        while(mustWait && status == GL_TIMEOUT_EXPIRED);
+        if(status == GL_TIMEOUT_EXPIRED)
+            break;
+        chunksInFlight_.pop_front();
+
+        GLuint64 elapsed=0; // ns
+        glGetQueryObjectui64v(chunk.timeQuery, GL_QUERY_RESULT, &elapsed);
+        glDeleteSync(chunk.fence);
+        freeTimeQueries_.push_back(chunk.timeQuery);
+        auto stats = chunk.stats;
+        stats.gpuTime = std::chrono::nanoseconds(elapsed);
+        profiler_.addIteration(stats);
+        if(stats.fragments <= 0 || elapsed == 0)
+            continue;
+        // The cost of a pixel varies over the pattern and between the modes, so the area
+        // changes gradually towards the one that would have taken the target time
+        const double targetArea = stats.fragments * (std::chrono::nanoseconds(targetChunkTime).count() / double(elapsed));
+        const double area = std::clamp(targetArea, renderAreaPerIteration_/2., renderAreaPerIteration_*2.);
+        renderAreaPerIteration_ = std::clamp(int(area), 50, std::max(50, width()*height()));
+    }
+}
+
+// Forgets the iterations in flight, e.g. of a render that was restarted
+void Canvas::dropChunkTimings()
+{
+    for(const auto& chunk : chunksInFlight_)
+    {
+        glDeleteSync(chunk.fence);
+        freeTimeQueries_.push_back(chunk.timeQuery);
+    }
+    chunksInFlight_.clear();
+}
+
+// Each sample is rendered progressively over the whole target, tile by tile. The area per
+// iteration carries over from the last pass. The depth buffer marks the converged pixels.
+void Canvas::startSamplePass()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, luminanceFBO_);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    if(polarMode_ != PolarMode::Off)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, polarFBO_);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+    resetTilePass();
+    if(tools_->adaptiveSampling() && samplesDone_ >= minAdaptiveSampleCount)
+        maskConvergedPixels();
+}
+
+// Writes depth where the samples so far have converged, so that the depth test rejects those
+// pixels of the sampling target in the next passes
+void Canvas::maskConvergedPixels()
+{
+    // The statistics can't be sampled while being attached to the framebuffer, so the depth
+    // buffer is written via a framebuffer of its own
+    const bool polar = polarMode_ == PolarMode::ImageWedge;
+    if(!maskFBO_)
+        glGenFramebuffers(1, &maskFBO_);
+    glBindFramebuffer(GL_FRAMEBUFFER, maskFBO_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,
+                              polar ? polarDepthRenderBuffer_ : depthRenderBuffer_);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glViewport(0, 0, polar ? polarWidth_ : width(), polar ? polarHeight_ : height());
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(true);
+
+    convergenceMask_.bind();
+    convergenceMask_.setUniformValue("tolerance", float(tools_->samplingTolerance()));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, polar ? polarTexture_ : luminanceTexture_);
+    convergenceMask_.setUniformValue("luminanceXYZW", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, polar ? polarStatsTexture_ : luminanceStatsTexture_);
+    convergenceMask_.setUniformValue("sampleStats", 1);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glDisable(GL_DEPTH_TEST);
+}
+
+// Runs the glare shader for all wavelengths of the current sample in the next tiles.
+// Returns true when the whole render target has the sample.
+bool Canvas::renderGlare()
+{
+    const bool polar = polarMode_ != PolarMode::Off;
+    const int renderWidth  = polar ? polarWidth_  : width();
+    const int renderHeight = polar ? polarHeight_ : height();
+    glBindFramebuffer(GL_FRAMEBUFFER, polar ? polarFBO_ : luminanceFBO_);
+    glViewport(0, 0, renderWidth, renderHeight);
+
+    const auto tiles = nextTiles();
+
+    // The targets are cleared before the first sample, so everything can be simply added up.
+    // The depth test only rejects the converged pixels.
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(false);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    bindGlareProgram(polarMode_, 1, true, spectrumTexture_);
+
+    // The monochromatic pattern is sampled at texel centers, with no spectral weights:
+    // both come in when the spectrum is gathered
+    const bool monochromatic = polarMode_ == PolarMode::MonochromaticPattern;
+    const int wavelengthCount = wavelengths_.size();
+    const int batchCount = monochromatic ? 1 : (wavelengthCount+wavelengthBatchSize-1)/wavelengthBatchSize;
+    const auto& u = glareUniforms_;
+    glareProgram_.setUniformValue(u.wavelengthCount, wavelengthCount);
+    glareProgram_.setUniformValue(u.sampleShift, sampleShift(monochromatic ? 0 : samplesDone_));
+    glareProgram_.setUniformValue(u.secondHalf, float(inSecondHalf(samplesDone_)));
+    // One instance per batch of wavelengths, see the glare vertex shader
+    drawTiles(tiles, renderWidth, renderHeight, batchCount);
+    unbindGlareTextures();
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(true);
+
+    if(polarMode_ == PolarMode::ImageWedge)
+        resampleWedge();
+
+    return pendingTiles_.empty();
+}
+
+// Binds the glare shader and sets all its inputs but the wavelength count and the sample. With
+// pixelSize > 1, each pixel of the target covers pixelSize² px of the image. The textures are
+// bound to units 0–2, see unbindGlareTextures().
+void Canvas::bindGlareProgram(const PolarMode coordinates, const int pixelSize, const bool allowSideTable,
+                              const GLuint spectrumTexture)
+{
+    glareProgram_.bind();
+
+    const auto& u = glareUniforms_;
+    glareProgram_.setUniformValue(u.imageSize, QVector2D(width(), height()));
+    glareProgram_.setUniformValue(u.targetWidth, float(1000*tools_->screenWidth()));
+    glareProgram_.setUniformValue(u.coordinates, int(coordinates));
+    glareProgram_.setUniformValue(u.zoom, float(1<<zoomLevel_) / pixelSize);
+    glareProgram_.setUniformValue(u.viewOrigin, QVector2D(viewOrigin()) / pixelSize);
+    if(coordinates != PolarMode::Off)
+    {
+        glareProgram_.setUniformValue(u.wedgeStartAngle, polarStartAngle_);
+        glareProgram_.setUniformValue(u.wedgeStep, polarStep_);
+    }
+    setupApertureTriangles();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, apertureTrianglesTexture_);
+    glareProgram_.setUniformValue(u.apertureTriangles, 0);
+    glareProgram_.setUniformValue(u.triangleCount, uploadedGeometry_->triangleCount());
+    glareProgram_.setUniformValue(u.edgeFormula, int(tools_->useEdgeFormula()));
+    glareProgram_.setUniformValue(u.apertureMaxRadius, apertureMaxRadius_);
+    const bool sideTable = allowSideTable && setupSideTable();
+    glareProgram_.setUniformValue(u.sideTable, int(sideTable));
+    // Samplers of different types must not share a unit, so it's bound to its own even when unused
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, sideTable ? sideTableTexture_ : 0);
+    glareProgram_.setUniformValue(u.sideTransform, 1);
+    if(sideTable)
+    {
+        const auto step = sideTable_->step();
+        const auto centroid = sideTable_->centroid();
+        glareProgram_.setUniformValue(u.sideTableStep, QVector2D(step.x, step.y));
+        glareProgram_.setUniformValue(u.sideCount, sideTable_->sideCount());
+        glareProgram_.setUniformValue(u.sideCentroid, QVector2D(centroid.x, centroid.y));
+    }
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, spectrumTexture);
+    glareProgram_.setUniformValue(u.spectrum, 2);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Canvas::unbindGlareTextures()
+{
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Canvas::setupLowResTarget(const int width, const int height)
+{
+    if(width == lowResWidth_ && height == lowResHeight_)
+        return;
+    lowResWidth_ = width;
+    lowResHeight_ = height;
+    for(const auto texture : {&lowResTexture_, &lowResStatsTexture_})
+    {
+        if(!*texture)
+            glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        // Upscaled to the image when displayed
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if(!lowResFBO_)
+        glGenFramebuffers(1, &lowResFBO_);
+    glBindFramebuffer(GL_FRAMEBUFFER, lowResFBO_);
+    glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,lowResTexture_,0);
+    glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,lowResStatsTexture_,0);
+    const GLenum drawBuffers[]={GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+}
+
+// Adapts the work of the next low-res frames to the GPU time of the last one timed, once it's known
+void Canvas::collectLowResTiming()
+{
+    if(!lowResQueryPending_)
+        return;
+    GLint available=0;
+    glGetQueryObjectiv(lowResTimeQuery_, GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+        return;
+    lowResQueryPending_=false;
+    GLuint64 elapsed=0; // ns
+    glGetQueryObjectui64v(lowResTimeQuery_, GL_QUERY_RESULT, &elapsed);
+    if(elapsed == 0)
+        return;
+    const double targetWork = lowResTimedWork_ * (std::chrono::nanoseconds(targetLowResFrameTime).count() / double(elapsed));
+    lowResWork_ = std::clamp(targetWork, lowResWork_/2, lowResWork_*2);
+}
+
+// Renders the whole image with a single sample per pixel at a fraction of the resolution and with
+// a few wavelengths, directly rather than via the polar targets. The work, in px × wavelengths,
+// is first spent on the wavelengths, as at a quarter of the resolution, then the resolution is
+// fitted to what remains.
+void Canvas::renderLowResImage()
+{
+    collectLowResTiming();
+    const int maxWavelengthCount = std::min(tools_->wavelengthCount(), maxLowResWavelengthCount);
+    const double quarterArea = width()*height()/16.;
+    const int wavelengthCount = std::clamp(int(lowResWork_/quarterArea), std::min(3, maxWavelengthCount), maxWavelengthCount);
+    const int pixelSize = std::clamp(int(std::ceil(std::sqrt(width()*height()*double(wavelengthCount)/lowResWork_))),
+                                     1, maxLowResPixelSize);
+    const int w = (width()+pixelSize-1)/pixelSize, h = (height()+pixelSize-1)/pixelSize;
+
+    std::vector<float> wavelengths;
+    std::vector<glm::vec4> weights;
+    for(const auto& node : lowResQuadrature_.nodes(*tools_->sourceSpectrum(), tools_->spectralRule(), wavelengthCount))
+    {
+        wavelengths.push_back(node.wavelength);
+        weights.push_back(node.weight);
+    }
+    uploadSpectrum(wavelengths, weights, lowResSpectrumBuffer_, lowResSpectrumTexture_);
+
+    GLint targetFBO=-1;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+    setupLowResTarget(w, h);
+    glBindFramebuffer(GL_FRAMEBUFFER, lowResFBO_);
+    glViewport(0, 0, w, h);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    bindGlareProgram(PolarMode::Off, pixelSize, false, lowResSpectrumTexture_);
+    const auto& u = glareUniforms_;
+    glareProgram_.setUniformValue(u.wavelengthCount, wavelengthCount);
+    // Samples the center of the block of pixels
+    glareProgram_.setUniformValue(u.sampleShift, QVector2D(0.5f, 0.5f) / pixelSize);
+    glareProgram_.setUniformValue(u.secondHalf, 0.f);
+
+    // A query still in flight can't be reused, so such frames simply aren't timed
+    const bool timed = !lowResQueryPending_;
+    if(timed)
+    {
+        if(!lowResTimeQuery_)
+            glGenQueries(1, &lowResTimeQuery_);
+        glBeginQuery(GL_TIME_ELAPSED, lowResTimeQuery_);
+    }
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (wavelengthCount+wavelengthBatchSize-1)/wavelengthBatchSize);
+    if(timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        lowResQueryPending_=true;
+        lowResTimedWork_ = double(w)*h*wavelengthCount;
+    }
+    unbindGlareTextures();
+    glDisable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+
+    lowResKey_=renderKey();
+    lowResPixelSize_=pixelSize;
+    emit renderStatusChanged(tr("Previewing at 1/%1 of the resolution with %2 wavelengths")
+                                .arg(pixelSize).arg(wavelengthCount));
+}
+
+// Fills the whole image by rotating and reflecting the wedge
+void Canvas::resampleWedge()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, luminanceFBO_);
+    glViewport(0, 0, width(), height());
+    wedgeToImage_.bind();
+    wedgeToImage_.setUniformValue("imageSize", QVector2D(width(), height()));
+    wedgeToImage_.setUniformValue("wedgeAngle", polarAngle_);
+    wedgeToImage_.setUniformValue("wedgeStartAngle", polarStartAngle_);
+    wedgeToImage_.setUniformValue("wedgeStep", polarStep_);
+    glBindTexture(GL_TEXTURE_2D, polarTexture_);
+    wedgeToImage_.setUniformValue("wedge", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, polarStatsTexture_);
+    wedgeToImage_.setUniformValue("wedgeSampleStats", 1);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// The polar textures are in the frame of the aperture, so a rotation of the aperture only
+// changes how they map onto the image: the wedge is simply resampled, and the spectrum is
+// gathered again from the monochromatic pattern.
+void Canvas::rotatePolarTarget()
+{
+    const auto geometry = tools_->apertureGeometry();
+    polarStartAngle_ = polarMirrored_ ? geometry->mirrorAxisAngle() : geometry->parameters().globalRotationAngle;
+    renderKey_=renderKey();
+
+    GLint targetFBO=-1;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+    glBindVertexArray(vao_);
+    if(polarMode_ == PolarMode::ImageWedge)
+    {
+        // While the wedge is being rendered, it's resampled after each iteration anyway
+        if(!drawingInProgress_)
+            resampleWedge();
+    }
+    else if(gatheringSpectrum_ || !drawingInProgress_)
+    {
+        keepPreview();
+        glBindFramebuffer(GL_FRAMEBUFFER, luminanceFBO_);
+        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+        drawingInProgress_=true;
+        gatheringSpectrum_=true;
+        samplesDone_=0;
+        resetProgressiveRendering();
+    }
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+    glViewport(0, 0, width(), height());
+}
+
+// Copies the current image to be shown, rotated and rescaled, until the next one covers it. An
+// image that doesn't cover the whole target yet is no better than the preview it would replace.
+void Canvas::keepPreview()
+{
+    if(drawingInProgress_ && samplesDone_==0)
+        return;
+    GLint oldFBO=-1;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &oldFBO);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, luminanceFBO_);
+    for(const auto [attachment, texture] : {std::pair{GL_COLOR_ATTACHMENT0, previewTexture_},
+                                            std::pair{GL_COLOR_ATTACHMENT1, previewStatsTexture_}})
+    {
+        glReadBuffer(attachment);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width(), height());
+        // Shrinking the pattern samples the coarser levels
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, oldFBO);
+    previewRotationAngle_=prevRotationAngle_;
+    previewApertureRadius_=prevApertureRadius_;
+    previewScreenWidth_=prevScreenWidth_;
+    havePreview_=true;
+}
+
+// Integrates the monochromatic pattern over the spectrum for the current sample of the pixels
+// in the next tiles, rescaling it radially for each wavelength. Returns true when the whole
+// image has the sample.
+bool Canvas::gatherSpectrum()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, luminanceFBO_);
+    glViewport(0, 0, width(), height());
+
+    const auto tiles = nextTiles();
+    // The depth test rejects the converged pixels
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(false);
+    glBlendFunc(GL_ONE, GL_ONE);
+    if(samplesDone_ > 0)
+        glEnable(GL_BLEND);
+
+    spectralGather_.bind();
+    spectralGather_.setUniformValue("imageSize", QVector2D(width(), height()));
+    spectralGather_.setUniformValue("targetWidth", float(1000*tools_->screenWidth()));
+    spectralGather_.setUniformValue("sampleShift", sampleShift(samplesDone_));
+    spectralGather_.setUniformValue("secondHalf", float(inSecondHalf(samplesDone_)));
+    spectralGather_.setUniformValue("wavelengthCount", int(wavelengths_.size()));
+    spectralGather_.setUniformValue("patternStep", polarStep_);
+    spectralGather_.setUniformValue("patternAngle", polarAngle_);
+    spectralGather_.setUniformValue("patternStartAngle", polarStartAngle_);
+    spectralGather_.setUniformValue("patternMirrored", int(polarMirrored_));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, polarTexture_);
+    spectralGather_.setUniformValue("pattern", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, spectrumTexture_);
+    spectralGather_.setUniformValue("spectrum", 1);
+    drawTiles(tiles, width(), height(), 1);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(true);
+
+    return pendingTiles_.empty();
+}
+
+void Canvas::paintGL()
+{
+    if(!isVisible() || width()==0 || height()==0) return;
+
+    if(cpuRenderer_)
+    {
+        paintWithCPU();
+        return;
+    }
+
+    if(width()!=lastWidth_ || height()!=lastHeight_)
+    {
+        needRedraw_=true;
+        // NOTE: we don't use QOpenGLWindow::resizeGL(), because it's sometimes called _after_
+        // QOpenGLWindow::paintGL() instead of before. This breaks rendering until subsequent
+        // repaint, which doesn't happen if nothing triggers it.
+        lastWidth_=width();
+        lastHeight_=height();
+        setupRenderTarget();
+    }
+
+    checkSettings();
+
+    glBindVertexArray(vao_);
+
+    if(needRedraw_ && loadFromCache())
+    {
+        needRedraw_=false;
+        drawingInProgress_=false;
+        dropChunkTimings();
+        profiler_.finishRender();
+        emit renderStatusChanged(tr("Loaded from the cache"));
+    }
+
+    // While the user keeps changing the settings, the low-res image is shown instead of the full
+    // one, whose work onSettingChanged() has already dropped
+    if(needRedraw_ && settingsChangedByUser_)
+    {
+        interacting_=true;
+        interactionTimer_.start();
+    }
+    settingsChangedByUser_=false;
+
+    if(interacting_)
+    {
+        if(lowResKey_ != renderKey())
+            renderLowResImage();
+    }
+    else if(needRedraw_ || drawingInProgress_)
+    {
+        GLint targetFBO=-1;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+
+        if(needRedraw_)
+        {
+            polarMode_ = setupPolarTarget();
+            setupSpectrum();
+            glBindFramebuffer(GL_FRAMEBUFFER, luminanceFBO_);
+            glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+            if(polarMode_ != PolarMode::Off)
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, polarFBO_);
+                glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+            }
+            restoreCachedTiles();
+            drawingInProgress_=true;
+            gatheringSpectrum_=false;
+            samplesDone_=0;
+            refinable_=true;
+            resumeSampling_=false;
+            resetProgressiveRendering();
+            dropChunkTimings();
+            profiler_.startRender(renderDescription(), sqr(tools_->sampleCount()));
+        }
+        else if(resumeSampling_)
+        {
+            startSamplePass();
+            resumeSampling_=false;
+        }
+
+        const auto time0=std::chrono::steady_clock::now();
+        if(freeTimeQueries_.empty())
+        {
+            freeTimeQueries_.resize(maxChunksInFlight+1);
+            glGenQueries(freeTimeQueries_.size(), freeTimeQueries_.data());
+        }
+        const GLuint timeQuery = freeTimeQueries_.back();
+        freeTimeQueries_.pop_back();
+        glBeginQuery(GL_TIME_ELAPSED, timeQuery);
+
+        const bool pattern = !gatheringSpectrum_ && polarMode_==PolarMode::MonochromaticPattern;
+        const char*const phase = gatheringSpectrum_ ? "gather" : pattern ? "pattern" :
+                                 polarMode_==PolarMode::ImageWedge ? "wedge" : "image";
+        bool done = gatheringSpectrum_ ? gatherSpectrum() : renderGlare();
+
+        glEndQuery(GL_TIME_ELAPSED);
+        RenderProfiler::Iteration stats{};
+        stats.phase = phase;
+        stats.sample = samplesDone_;
+        stats.submitted = time0;
+        stats.submissionTime = std::chrono::steady_clock::now() - time0;
+        stats.fragments = lastIterationArea_;
+        // The pattern doesn't depend on the wavelength, and the gather evaluates no triangles
+        const int wavelengthFactor = gatheringSpectrum_ ? 0 : pattern ? 1 : wavelengths_.size();
+        stats.triangleEvaluations = stats.fragments * uploadedGeometry_->triangleCount() * wavelengthFactor;
+        stats.completesFrame = done && samplesDone_==0 && !pattern;
+        chunksInFlight_.push_back({timeQuery, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), stats});
+        // Instead of waiting for the GPU to finish each iteration, only keep it from running
+        // too far ahead
+        collectChunkTimings(maxChunksInFlight);
+
+        if(done && polarMode_ == PolarMode::MonochromaticPattern && !gatheringSpectrum_)
+        {
+            // The pattern is complete, now it's the turn of the image
+            gatheringSpectrum_=true;
+            resetProgressiveRendering();
+            done=false;
+        }
+        else if(done && ++samplesDone_ < sqr(tools_->sampleCount()))
+        {
+            // Show the image with the samples so far, then go over it again with the next one
+            startSamplePass();
+            done=false;
+        }
+
+        if(done)
         {
             drawingInProgress_=false;
+            collectChunkTimings(0);
+            profiler_.finishRender();
+            storeInCache();
+            storeFinishedTiles();
         }
         else
         {
             QTimer::singleShot(0, [this]{ update(); });
         }
 
+        emit renderStatusChanged(profiler_.status());
+
         glBindFramebuffer(GL_FRAMEBUFFER,targetFBO);
         needRedraw_=false;
     }
+    glViewport(0, 0, width(), height());
     luminanceToScreen_.bind();
     luminanceToScreen_.setUniformValue("exposure", float(std::pow(10., tools_->exposure())));
     glBindTexture(GL_TEXTURE_2D, luminanceTexture_);
     luminanceToScreen_.setUniformValue("luminanceXYZW", 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, luminanceStatsTexture_);
+    luminanceToScreen_.setUniformValue("sampleStats", 1);
+    luminanceToScreen_.setUniformValue("showSampleCounts", int(tools_->showSampleCounts()));
+    luminanceToScreen_.setUniformValue("maxSampleCount", float(sqr(tools_->sampleCount())));
+    luminanceToScreen_.setUniformValue("havePreview", int(havePreview_));
+    luminanceToScreen_.setUniformValue("imageSize", QVector2D(width(), height()));
+    luminanceToScreen_.setUniformValue("previewRotation", float(tools_->globalRotationAngle()-previewRotationAngle_));
+    luminanceToScreen_.setUniformValue("previewRadiusRatio", float(previewApertureRadius_/tools_->apertureRadius()));
+    luminanceToScreen_.setUniformValue("previewTargetWidth", float(1000*previewScreenWidth_));
+    luminanceToScreen_.setUniformValue("targetWidth", float(1000*tools_->screenWidth()));
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, previewTexture_);
+    luminanceToScreen_.setUniformValue("preview", 2);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, previewStatsTexture_);
+    luminanceToScreen_.setUniformValue("previewStats", 3);
+    // Once the settings stay put, the low-res image is the background of the full one
+    const bool haveLowResImage = interacting_ || (!lowResKey_.isEmpty() && lowResKey_ == renderKey_);
+    luminanceToScreen_.setUniformValue("haveLowResImage", int(haveLowResImage));
+    luminanceToScreen_.setUniformValue("lowResOnly", int(interacting_));
+    luminanceToScreen_.setUniformValue("lowResTexCoordScale",
+                                       QVector2D(float(width())/(lowResPixelSize_*std::max(1, lowResWidth_)),
+                                                 float(height())/(lowResPixelSize_*std::max(1, lowResHeight_))));
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, lowResTexture_);
+    luminanceToScreen_.setUniformValue("lowResImage", 4);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, lowResStatsTexture_);
+    luminanceToScreen_.setUniformValue("lowResStats", 5);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
     glBindVertexArray(0);
 }
 
+void Canvas::mousePressEvent(QMouseEvent*const event)
+{
+    if(event->button() != Qt::LeftButton || cpuRenderer_)
+        return;
+    dragging_=true;
+    lastMousePos_=event->pos();
+}
+
+void Canvas::mouseMoveEvent(QMouseEvent*const event)
+{
+    // The window's y axis points down, while the image's one points up
+    const auto pos = event->pos();
+    cursorPos_ = QPoint(pos.x(), height()-pos.y());
+    cursorInside_ = true;
+    tileOrderStale_ = true;
+    if(!dragging_)
+        return;
+    viewOffset_ += QPoint(lastMousePos_.x()-pos.x(), pos.y()-lastMousePos_.y());
+    lastMousePos_=pos;
+    update();
+}
+
+bool Canvas::event(QEvent*const event)
+{
+    if(event->type() == QEvent::Leave)
+    {
+        cursorInside_ = false;
+        tileOrderStale_ = true;
+    }
+    return QOpenGLWindow::event(event);
+}
+
+void Canvas::mouseReleaseEvent(QMouseEvent*const event)
+{
+    if(event->button() == Qt::LeftButton)
+        dragging_=false;
+}
+
+void Canvas::mouseDoubleClickEvent(QMouseEvent*)
+{
+    if(defaultView())
+        return;
+    zoomLevel_=0;
+    viewOffset_=QPoint();
+    update();
+}
+
+// Each step of the wheel zooms in or out by a factor of 2, keeping the point under the cursor in place
+void Canvas::wheelEvent(QWheelEvent*const event)
+{
+    if(cpuRenderer_)
+        return;
+    wheelDelta_ += event->angleDelta().y();
+    const int steps = wheelDelta_ / QWheelEvent::DefaultDeltasPerStep;
+    wheelDelta_ -= steps * QWheelEvent::DefaultDeltasPerStep;
+    const int level = std::clamp(zoomLevel_+steps, 0, maxZoomLevel);
+    if(level == zoomLevel_)
+        return;
+#if QT_VERSION >= QT_VERSION_CHECK(5,14,0)
+    const auto pos = event->position();
+#else
+    const auto pos = event->posF();
+#endif
+    const QPointF fromCenter(pos.x()-std::round(width()/2.), height()-pos.y()-std::round(height()/2.));
+    const auto underCursor = (fromCenter+QPointF(viewOffset_)) * std::pow(2., level-zoomLevel_);
+    // Zooming out completely returns to the default view, where the polar modes work
+    viewOffset_ = level==0 ? QPoint() : (underCursor-fromCenter).toPoint();
+    zoomLevel_=level;
+    update();
+}
+
 void Canvas::saveImage()
 {
 #if QT_VERSION >= QT_VERSION_CHECK(6,2,0)
+    if(imageReadback_.buffer || imageSaving_.isRunning())
+    {
+        QMessageBox::information(tools_, tr("Save image"), tr("The previous image is still being saved to %1").arg(savePath_));
+        return;
+    }
     const auto path=QFileDialog::getSaveFileName(tools_, tr("Save image"), {}, "TIFF files (*.tiff *.tif)");
     if(path.isNull())
         return;
+    savePath_=path;
+
+    if(cpuRenderer_)
+    {
+        const int w = cpuRenderer_->width(), h = cpuRenderer_->height();
+        imageSaving_.setFuture(QtConcurrent::run([path, w, h, data=cpuRenderer_->luminance()]() mutable
+                                                 { return saveLuminanceImage(path, std::move(data), w, h); }));
+        return;
+    }
 
     makeCurrent();
-    GLint oldFBO=-1;
-    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &oldFBO);
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, luminanceFBO_);
-    const int w = width(), h = height();
-    using namespace glm;
-    std::vector<vec4> data(w * h);
-    glReadPixels(0, 0, w, h, GL_RGBA, GL_FLOAT, data.data());
-    const auto XYZ2sRGBl=mat3(vec3(3.2406,-0.9689,0.0557),
-                              vec3(-1.5372,1.8758,-0.204),
-                              vec3(-0.4986,0.0415,1.057));
-    float max = -INFINITY;
-    for(auto& v : data)
-    {
-        const vec3 rgb = XYZ2sRGBl * vec3(v);
-        v = vec4(rgb, 1);
-        const auto currMax = std::max({rgb.r, rgb.g, rgb.b});
-        if(currMax > max) max = currMax;
-    }
-    for(auto& v : data)
-        v = vec4(vec3(v) / max, 1);
-    QImage img(reinterpret_cast<const uchar*>(data.data()), w, h, QImage::Format_RGBX32FPx4);
-    img.setColorSpace(QColorSpace::SRgbLinear);
-    QImageWriter writer(path);
-    writer.setFormat("tiff");
-    if(!writer.write(img))
-        QMessageBox::critical(tools_, tr("Failed to save image"),
-                              tr("Failed to save image to %1: %2").arg(path).arg(writer.errorString()));
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, oldFBO);
+    startReadback(imageReadback_);
+    doneCurrent();
+    QTimer::singleShot(0, this, &Canvas::finishImageReadback);
 #endif
 }
+
+// Polls the readback started by saveImage(). Once it's done, the pixel buffer is mapped and a
+// worker thread averages the samples, converts the colors and encodes the image.
+void Canvas::finishImageReadback()
+{
+    if(!imageReadback_.buffer)
+        return;
+    makeCurrent();
+    if(!readbackFinished(imageReadback_))
+    {
+        doneCurrent();
+        QTimer::singleShot(readbackPollInterval, this, &Canvas::finishImageReadback);
+        return;
+    }
+    const auto sums = mapReadback(imageReadback_);
+    doneCurrent();
+    if(!sums)
+    {
+        releaseReadback(imageReadback_);
+        QMessageBox::critical(tools_, tr("Failed to save image"),
+                              tr("Failed to save image to %1: %2").arg(savePath_).arg(tr("failed to map the pixel buffer")));
+        return;
+    }
+
+    const auto size = imageReadback_.size();
+    const auto counts = reinterpret_cast<const float*>(sums+size);
+    imageSaving_.setFuture(QtConcurrent::run([this, sums, counts, size, path=savePath_,
+                                              w=imageReadback_.width, h=imageReadback_.height]
+    {
+        auto data = averageSamples(sums, counts, size);
+        // The buffer is released before encoding, so that the image isn't held twice meanwhile
+        QMetaObject::invokeMethod(this, [this]{ releaseReadback(imageReadback_); }, Qt::QueuedConnection);
+        return saveLuminanceImage(path, std::move(data), w, h);
+    }));
+}
+
+void Canvas::onImageSaved()
+{
+    const auto error = imageSaving_.result();
+    if(!error.isEmpty())
+        QMessageBox::critical(tools_, tr("Failed to save image"),
+                              tr("Failed to save image to %1: %2").arg(savePath_).arg(error));
+}
@@ -1,13 +1,26 @@
 #pragma once
 
 #include <cmath>
-#include <QVector4D>
+#include <deque>
+#include <memory>
+#include <QRect>
+#include <QPoint>
+#include <QVector2D>
+#include <QTimer>
+#include <QFutureWatcher>
 #include <QByteArray>
 #include <QOpenGLWindow>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLFunctions_3_3_Core>
+#include "CPUGlareRenderer.hpp"
+#include "SpectralQuadrature.hpp"
+#include "TilePyramid.hpp"
+#include "RenderProfiler.hpp"
 
 class ToolsWidget;
+class TiledCPURenderer;
+class SideTransformTable;
+class LuminanceCache;
 class Canvas : public QOpenGLWindow, public QOpenGLFunctions_3_3_Core
 {
     Q_OBJECT
@@ -15,16 +28,104 @@ public:
     Canvas(ToolsWidget* tools, UpdateBehavior updateBehavior=NoPartialUpdate, QWindow* parent=nullptr);
     ~Canvas();
 
+signals:
+    // Progress and throughput of the render, for the status bar
+    void renderStatusChanged(QString const& status);
+
 protected:
     void initializeGL() override;
     void paintGL() override;
+    void mousePressEvent(QMouseEvent* event) override;
+    void mouseMoveEvent(QMouseEvent* event) override;
+    void mouseReleaseEvent(QMouseEvent* event) override;
+    void mouseDoubleClickEvent(QMouseEvent* event) override;
+    void wheelEvent(QWheelEvent* event) override;
+    bool event(QEvent* event) override;
 private:
+    // Sums and sample counts of the image, copied into a pixel buffer without waiting for the
+    // GPU, and mapped once they're there for a worker thread to read
+    struct LuminanceReadback
+    {
+        GLuint buffer=0;
+        GLsync fence=nullptr;
+        bool mapped=false;
+        int width=0, height=0;
+        size_t size() const { return size_t(width)*height; }
+    };
+    // The values are passed to the glare shader as its coordinates uniform
+    enum class PolarMode
+    {
+        Off,         // the glare shader renders directly into luminanceTexture_
+        ImageWedge,  // XYZW of a symmetric wedge of the image, rotated and reflected into luminanceTexture_
+        MonochromaticPattern, // wavelength-independent |F(k)|², integrated over the spectrum into luminanceTexture_
+    };
+
     void saveImage();
+    void finishImageReadback();
+    void finishCacheReadback();
+    void onImageSaved();
     void setupBuffers();
     void setupShaders();
     void setupWavelengths();
+    void setupApertureTriangles();
+    bool setupSideTable();
+    void setupLuminanceCache();
+    void setupTileAtlas();
+    QByteArray tileKey() const;
+    QByteArray renderKey() const;
+    QString renderDescription() const;
+    void startReadback(LuminanceReadback& readback);
+    // False while the GPU hasn't finished the copy
+    bool readbackFinished(LuminanceReadback& readback);
+    // Returns the sums, followed by the sample counts, or null on failure
+    const glm::vec4* mapReadback(LuminanceReadback& readback);
+    void releaseReadback(LuminanceReadback& readback);
+    bool loadFromCache();
+    void storeInCache();
+    bool defaultView() const { return zoomLevel_==0 && viewOffset_.isNull(); }
+    // Position of the bottom left pixel of the image in pixels of the zoomed pattern from its center
+    QPoint viewOrigin() const;
+    // Tiles of the pyramid at the current zoom level that overlap the image, with their rects in the image
+    std::vector<std::pair<TilePyramid::TileID, QRect>> visibleTiles() const;
+    QPoint atlasSlotCorner(int slot) const;
+    // Copies both the sums and the statistics between render targets
+    void copyAttachments(GLuint srcFBO, QRect const& srcRect, GLuint dstFBO, QPoint const& dstPos);
+    void restoreCachedTiles();
+    void storeFinishedTiles();
+    double maxDistanceFromCenter() const;
+    double directionSine(double distFromCenter) const;
+    void setupSpectrum();
+    void uploadSpectrum(std::vector<float> const& wavelengths, std::vector<glm::vec4> const& weights,
+                        GLuint& buffer, GLuint& texture);
+    // Chooses the mode for the current settings and (re)allocates polarTexture_ for it
+    PolarMode setupPolarTarget();
     void setupRenderTarget();
-    QVector4D radianceToLuminance(unsigned texIndex) const;
+    void checkSettings();
+    void paintWithCPU();
+    void resetProgressiveRendering();
+    void collectChunkTimings(unsigned maxInFlight);
+    void dropChunkTimings();
+    void startSamplePass();
+    void maskConvergedPixels();
+    void setupTileGrid();
+    void resetTilePass();
+    float tilePriority(QRect const& tile) const;
+    std::vector<QRect> nextTiles();
+    void drawTiles(std::vector<QRect> const& tiles, int targetWidth, int targetHeight, int instanceCount);
+    void cancelRendering();
+    void onSettingChanged();
+    bool renderGlare();
+    void bindGlareProgram(PolarMode coordinates, int pixelSize, bool allowSideTable, GLuint spectrumTexture);
+    void unbindGlareTextures();
+    void setupLowResTarget(int width, int height);
+    void collectLowResTiming();
+    void renderLowResImage();
+    void resampleWedge();
+    void rotatePolarTarget();
+    void keepPreview();
+    bool gatherSpectrum();
+    CPUGlareRenderer::Parameters cpuRendererParameters() const;
+    float colorScale(float wavelength) const;
 
 private:
     ToolsWidget* tools_=nullptr;
@@ -33,22 +134,153 @@ private:
     int prevPointCount_=-1;
     int prevSampleCount_=-1;
     int prevWavelengthCount_=-1;
+    SpectralQuadrature::Rule prevSpectralRule_=SpectralQuadrature::Rule::Trapezoid;
+    std::shared_ptr<const SourceSpectrum> prevSourceSpectrum_;
     int prevArcPointCount_=-1;
     double prevApertureRadius_=NAN;
     double prevCurvatureRadius_=NAN;
+    bool prevUseSymmetry_=false;
+    bool prevMonochromaticPattern_=false;
+    bool prevUseEdgeFormula_=false;
+    bool prevUseSideTable_=false;
+    int prevSideTableSize_=-1;
+    bool prevAdaptiveSampling_=false;
+    double prevSamplingTolerance_=NAN;
+    int prevZoomLevel_=0;
+    QPoint prevViewOffset_;
     GLuint vao_=0;
     GLuint vbo_=0;
     GLuint luminanceFBO_=0;
-    GLuint luminanceTexture_=0;
+    GLuint luminanceTexture_=0; // sum of XYZW over the samples of each pixel
+    GLuint luminanceStatsTexture_=0; // number of those samples etc., see glare-shader.frag
     GLuint depthRenderBuffer_=0;
+    GLuint apertureTrianglesBuffer_=0;
+    GLuint apertureTrianglesTexture_=0;
+    std::shared_ptr<const ApertureGeometry> uploadedGeometry_;
+    float uploadedApertureRadius_=NAN;
+    float apertureMaxRadius_=0; // mm
+    std::unique_ptr<SideTransformTable> sideTable_;
+    GLuint sideTableTexture_=0;
+    // Intermediate render target in polar coordinates around the center of the pattern
+    PolarMode polarMode_=PolarMode::Off;
+    GLuint polarFBO_=0;
+    GLuint polarTexture_=0;
+    GLuint polarStatsTexture_=0;
+    GLuint polarDepthRenderBuffer_=0;
+    GLint polarFormat_=0;
+    int polarWidth_=0, polarHeight_=0;
+    // Angular extent of polarTexture_ and the direction where it starts. When polarMirrored_,
+    // the rest is obtained by rotations and reflections, otherwise the texture covers 2π.
+    float polarAngle_=0;
+    float polarStartAngle_=0;
+    bool polarMirrored_=false;
+    QVector2D polarStep_; // radial (px or mm^-1) and angular size of a texel
+    // In MonochromaticPattern mode the pattern is rendered first, then the spectrum is gathered from it
+    bool gatheringSpectrum_=false;
+    // Weights and wavenumbers, read by the glare shader in batches and by the spectral gather
+    GLuint spectrumBuffer_=0;
+    GLuint spectrumTexture_=0;
     int lastWidth_=0, lastHeight_=0;
     QOpenGLShaderProgram glareProgram_;
+    // Locations of the uniforms of glareProgram_
+    struct GlareUniforms
+    {
+        int imageSize=-1, targetWidth=-1, coordinates=-1, wedgeStartAngle=-1, wedgeStep=-1;
+        int apertureTriangles=-1, triangleCount=-1, edgeFormula=-1, apertureMaxRadius=-1;
+        int sideTable=-1, sideTransform=-1, sideTableStep=-1, sideCount=-1, sideCentroid=-1;
+        int spectrum=-1, wavelengthCount=-1, sampleShift=-1, secondHalf=-1, zoom=-1, viewOrigin=-1;
+    } glareUniforms_;
     QOpenGLShaderProgram luminanceToScreen_;
+    QOpenGLShaderProgram wedgeToImage_;
+    QOpenGLShaderProgram spectralGather_;
+    QOpenGLShaderProgram convergenceMask_;
+    GLuint maskFBO_=0; // to write depth of the target being sampled, see maskConvergedPixels()
+    // Copy of luminanceTexture_ and luminanceStatsTexture_ shown while a rotated or rescaled
+    // image is being rendered, with the settings it was rendered with
+    GLuint previewTexture_=0;
+    GLuint previewStatsTexture_=0;
+    double previewRotationAngle_=0;
+    double previewApertureRadius_=1;
+    double previewScreenWidth_=1;
+    bool havePreview_=false;
+    SpectralQuadrature spectralQuadrature_;
     std::vector<float> wavelengths_;
+    // Source spectrum times color matching functions times the quadrature weight, XYZW per wavelength
+    std::vector<glm::vec4> spectralWeights_;
     bool needRedraw_=true;
     bool drawingInProgress_=false;
-    int prevRenderArea_=0;
-    int prevScissorHeight_=0;
+    // Samples are added one full pass over the image at a time, so that a raised sample
+    // count refines the current image instead of starting over
+    int samplesDone_=0;
+    bool refinable_=false; // false for images from the cache, which have no per-sample sums
+    bool resumeSampling_=false;
     int renderAreaPerIteration_=0;
+    // Tiles of the current render target and whether they have the current sample
+    std::vector<QRect> tileRects_;
+    std::vector<bool> tileDone_;
+    // Indices of the tiles not done yet, the next one last. Sorted again when the cursor moves.
+    std::vector<int> pendingTiles_;
+    bool tileOrderStale_=true;
+    int lastIterationArea_=0; // px
+    GLuint tileVAO_=0, tileVBO_=0;
+    // The user is changing the settings, see renderLowResImage()
+    bool settingsChangedByUser_=false;
+    bool interacting_=false;
+    QTimer interactionTimer_;
+    GLuint lowResFBO_=0;
+    GLuint lowResTexture_=0;
+    GLuint lowResStatsTexture_=0;
+    int lowResWidth_=0, lowResHeight_=0;
+    int lowResPixelSize_=1; // px of the image per texel
+    QByteArray lowResKey_; // renderKey() of the low-res image
+    SpectralQuadrature lowResQuadrature_;
+    GLuint lowResSpectrumBuffer_=0;
+    GLuint lowResSpectrumTexture_=0;
+    double lowResWork_=256*256*8; // px × wavelengths per frame
+    GLuint lowResTimeQuery_=0;
+    bool lowResQueryPending_=false;
+    double lowResTimedWork_=0;
+    QPoint cursorPos_; // in the image, y up
+    bool cursorInside_=false;
+    // Iterations submitted to the GPU whose time hasn't been read yet, oldest first
+    struct ChunkInFlight
+    {
+        GLuint timeQuery;
+        GLsync fence;
+        RenderProfiler::Iteration stats; // without the GPU time yet
+    };
+    std::deque<ChunkInFlight> chunksInFlight_;
+    std::vector<GLuint> freeTimeQueries_;
+    RenderProfiler profiler_;
     QByteArray glareFragShader;
+    // The view is zoomed by 2^zoomLevel_, and its center is viewOffset_ px of the zoomed
+    // pattern away from the center of the pattern
+    int zoomLevel_=0;
+    QPoint viewOffset_;
+    bool dragging_=false;
+    QPoint lastMousePos_;
+    int wheelDelta_=0; // accumulated until a whole step of the wheel
+    // Finished tiles of the recent views. The tiles of the schedule that the rects of those
+    // restored into the current image contain start every pass marked in tileDone_, so they
+    // aren't rendered.
+    std::unique_ptr<TilePyramid> tilePyramid_;
+    GLuint tileAtlasFBO_=0;
+    GLuint tileAtlasTexture_=0;
+    GLuint tileAtlasStatsTexture_=0;
+    int atlasSlotsPerSide_=0;
+    std::vector<QRect> restoredTileRects_;
+    // Image being saved: read back into a pixel buffer, then averaged, converted and encoded on
+    // a worker thread
+    QString savePath_;
+    LuminanceReadback imageReadback_;
+    QFutureWatcher<QString> imageSaving_;
+    // Null when disabled by APERDIFF_CACHE_LIMIT_MB=0
+    std::unique_ptr<LuminanceCache> luminanceCache_;
+    QByteArray renderKey_; // of the image being rendered
+    // Finished image being stored in the cache, the same way as an image being saved
+    QByteArray cacheKey_;
+    LuminanceReadback cacheReadback_;
+    QFuture<void> cacheStoring_;
+    // Non-null when OpenGL 3.3 is unavailable and rendering falls back to the CPU
+    std::unique_ptr<TiledCPURenderer> cpuRenderer_;
 };
@@ -0,0 +1,111 @@
+#include "LuminanceCache.hpp"
+#include <cstring>
+#include <algorithm>
+#include <QDir>
+#include <QDebug>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
+
+namespace
+{
+constexpr char magic[8]={'A','P','D','X','Y','Z','W','1'};
+// 16 bytes, so that the floats that follow stay aligned for glm::vec4
+struct Header
+{
+    char magic[8];
+    qint32 width;
+    qint32 height;
+};
+static_assert(sizeof(Header)==16, "Header must keep the data aligned");
+const char*const fileSuffix=".xyzw";
+}
+
+LuminanceCache::MappedImage::~MappedImage()
+{
+    if(mapping_)
+        file_.unmap(mapping_);
+}
+
+LuminanceCache::LuminanceCache(QString const& directory, const qint64 maxBytes)
+    : directory_(directory)
+    , maxBytes_(maxBytes)
+{
+    if(!QDir().mkpath(directory))
+        qWarning() << "Failed to create luminance cache directory" << directory;
+}
+
+QString LuminanceCache::filePath(QByteArray const& key) const
+{
+    const auto hash = QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex();
+    return directory_ + "/" + QString::fromLatin1(hash) + fileSuffix;
+}
+
+std::unique_ptr<LuminanceCache::MappedImage> LuminanceCache::find(QByteArray const& key, const int width, const int height) const
+{
+    auto image = std::make_unique<MappedImage>();
+    image->file_.setFileName(filePath(key));
+    const qint64 expectedSize = sizeof(Header) + qint64(width)*height*sizeof(glm::vec4);
+    if(!image->file_.open(QIODevice::ReadOnly) || image->file_.size() != expectedSize)
+        return nullptr;
+    image->mapping_ = image->file_.map(0, expectedSize);
+    if(!image->mapping_)
+        return nullptr;
+    Header header;
+    std::memcpy(&header, image->mapping_, sizeof header);
+    if(std::memcmp(header.magic, magic, sizeof magic)!=0 || header.width!=width || header.height!=height)
+        return nullptr;
+    image->width_ = width;
+    image->height_ = height;
+    image->data_ = reinterpret_cast<const glm::vec4*>(image->mapping_ + sizeof header);
+
+    // The modification time is what eviction orders the entries by
+    image->file_.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    return image;
+}
+
+void LuminanceCache::insert(QByteArray const& key, const int width, const int height, const glm::vec4*const data)
+{
+    const qint64 dataSize = qint64(width)*height*sizeof(glm::vec4);
+    if(qint64(sizeof(Header)) + dataSize > maxBytes_)
+        return;
+
+    // Written under a temporary name and renamed, so a concurrent find() never sees a partial file
+    QSaveFile file(filePath(key));
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Failed to open" << file.fileName() << "for writing:" << file.errorString();
+        return;
+    }
+    Header header;
+    std::memcpy(header.magic, magic, sizeof magic);
+    header.width = width;
+    header.height = height;
+    file.write(reinterpret_cast<const char*>(&header), sizeof header);
+    file.write(reinterpret_cast<const char*>(data), dataSize);
+    if(!file.commit())
+    {
+        qWarning() << "Failed to write" << file.fileName() << ":" << file.errorString();
+        return;
+    }
+    evict();
+}
+
+void LuminanceCache::evict()
+{
+    QDir dir(directory_);
+    // Newest first
+    auto entries = dir.entryInfoList({QString("*")+fileSuffix}, QDir::Files, QDir::Time);
+    qint64 totalSize = 0;
+    for(const auto& entry : entries)
+    {
+        totalSize += entry.size();
+        if(totalSize > maxBytes_)
+        {
+            if(!QFile::remove(entry.filePath()))
+                qWarning() << "Failed to remove" << entry.filePath() << "from luminance cache";
+            totalSize -= entry.size();
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+#include <glm/glm.hpp>
+
+// Disk cache of finished XYZW images, one file per image, named by a hash of everything the
+// image depends on. The files are a small header followed by the raw floats in the layout of
+// Canvas::luminanceTexture_, so that a hit is memory-mapped and uploaded without copying.
+// When the total size exceeds the limit, the least recently used files are removed. Entries
+// are inserted on a worker thread, concurrently with lookups, which only ever see whole files.
+class LuminanceCache
+{
+public:
+    // A cached image mapped into memory; the mapping lives as long as this object
+    class MappedImage
+    {
+    public:
+        ~MappedImage();
+        int width() const { return width_; }
+        int height() const { return height_; }
+        const glm::vec4* data() const { return data_; }
+    private:
+        friend class LuminanceCache;
+        QFile file_;
+        uchar* mapping_=nullptr;
+        const glm::vec4* data_=nullptr;
+        int width_=0, height_=0;
+    };
+
+    LuminanceCache(QString const& directory, qint64 maxBytes);
+
+    // Returns null if there's no valid entry for the key with the given size
+    std::unique_ptr<MappedImage> find(QByteArray const& key, int width, int height) const;
+    void insert(QByteArray const& key, int width, int height, const glm::vec4* data);
+
+    QString const& directory() const { return directory_; }
+    qint64 maxBytes() const { return maxBytes_; }
+
+private:
+    QString filePath(QByteArray const& key) const;
+    void evict();
+
+private:
+    QString directory_;
+    qint64 maxBytes_;
+};
@@ -0,0 +1,196 @@
+#include "RenderProfiler.hpp"
+#include <algorithm>
+#include <QDebug>
+#include <QObject>
+#include <QStringList>
+#include <QJsonDocument>
+
+namespace
+{
+// Threads of the trace
+enum
+{
+    RENDER_THREAD,
+    SUBMISSION_THREAD,
+    GPU_THREAD,
+};
+
+QString csvQuoted(QString str)
+{
+    return '"' + str.replace('"', "\"\"") + '"';
+}
+
+double seconds(const RenderProfiler::Clock::duration time)
+{
+    return std::chrono::duration<double>(time).count();
+}
+}
+
+RenderProfiler::RenderProfiler()
+{
+    const auto path = qEnvironmentVariable("APERDIFF_PROFILE");
+    if(path.isEmpty())
+        return;
+    log_ = std::make_unique<QFile>(path);
+    if(!log_->open(QIODevice::WriteOnly|QIODevice::Truncate|QIODevice::Text))
+    {
+        qWarning() << "Failed to open profile log" << path << ":" << log_->errorString();
+        log_.reset();
+        return;
+    }
+    csv_ = path.endsWith(".csv", Qt::CaseInsensitive);
+    if(csv_)
+    {
+        log_->write("device,render,description,phase,sample,submitted_ms,submission_ms,gpu_ms,"
+                    "fragments,triangle_evaluations,triangle_evaluations_per_second\n");
+        return;
+    }
+    // The closing bracket is optional in the JSON array format of the trace, so a log cut short stays readable
+    log_->write("[\n");
+    const std::pair<int, const char*> threadNames[]={{RENDER_THREAD, "Renders"},
+                                                     {SUBMISSION_THREAD, "Submission (CPU)"},
+                                                     {GPU_THREAD, "GPU"}};
+    for(const auto& [thread, name] : threadNames)
+        writeTraceEvent({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", thread},
+                         {"args", QJsonObject{{"name", name}}}});
+}
+
+RenderProfiler::~RenderProfiler()
+{
+    if(log_ && !csv_)
+        log_->write("\n]\n");
+}
+
+void RenderProfiler::setDevice(QString const& device)
+{
+    device_ = device;
+    if(log_ && !csv_)
+        writeTraceEvent({{"name", "process_name"}, {"ph", "M"}, {"pid", 1},
+                         {"args", QJsonObject{{"name", "aperdiff on " + device}}}});
+}
+
+double RenderProfiler::microseconds(const Clock::time_point time) const
+{
+    return std::chrono::duration<double, std::micro>(time - startTime_).count();
+}
+
+void RenderProfiler::writeTraceEvent(QJsonObject event)
+{
+    if(!firstTraceEvent_)
+        log_->write(",\n");
+    firstTraceEvent_=false;
+    log_->write(QJsonDocument(event).toJson(QJsonDocument::Compact));
+    log_->flush();
+}
+
+void RenderProfiler::writeTraceSpan(QString const& name, const int thread, const Clock::time_point start,
+                                    const Clock::duration duration, QJsonObject const& args)
+{
+    writeTraceEvent({{"name", name}, {"ph", "X"}, {"pid", 1}, {"tid", thread},
+                     {"ts", microseconds(start)},
+                     {"dur", std::chrono::duration<double, std::micro>(duration).count()},
+                     {"args", args}});
+}
+
+void RenderProfiler::startRender(QString const& description, const int totalSamples)
+{
+    rendering_=true;
+    ++renderIndex_;
+    description_=description;
+    totalSamples_=totalSamples;
+    lastSample_=0;
+    renderStart_=Clock::now();
+    wallTime_=Clock::duration::zero();
+    firstFrameTime_=Clock::duration(-1);
+    iterationCount_=0;
+    gpuTime_=lastGPUTime_=std::chrono::nanoseconds::zero();
+    submissionTime_=Clock::duration::zero();
+    triangleEvaluations_=0;
+    gpuTrackEnd_=renderStart_;
+}
+
+void RenderProfiler::addIteration(Iteration const& iteration)
+{
+    if(!rendering_)
+        return;
+    ++iterationCount_;
+    lastSample_=iteration.sample;
+    gpuTime_ += iteration.gpuTime;
+    lastGPUTime_ = iteration.gpuTime;
+    submissionTime_ += iteration.submissionTime;
+    triangleEvaluations_ += iteration.triangleEvaluations;
+    // Observed no earlier than the next frame, so this somewhat overestimates the time
+    if(iteration.completesFrame && firstFrameTime_ < Clock::duration::zero())
+        firstFrameTime_ = Clock::now() - renderStart_;
+    if(!log_)
+        return;
+
+    using ms = std::chrono::duration<double, std::milli>;
+    const double gpuSeconds = std::chrono::duration<double>(iteration.gpuTime).count();
+    const double throughput = gpuSeconds > 0 ? iteration.triangleEvaluations / gpuSeconds : 0;
+    if(csv_)
+    {
+        const QStringList fields{csvQuoted(device_), QString::number(renderIndex_), csvQuoted(description_),
+                                 iteration.phase, QString::number(iteration.sample),
+                                 QString::number(ms(iteration.submitted - startTime_).count()),
+                                 QString::number(ms(iteration.submissionTime).count()),
+                                 QString::number(ms(iteration.gpuTime).count()),
+                                 QString::number(iteration.fragments),
+                                 QString::number(iteration.triangleEvaluations),
+                                 QString::number(throughput)};
+        log_->write((fields.join(',')+'\n').toUtf8());
+        log_->flush();
+        return;
+    }
+    const QJsonObject args{{"sample", iteration.sample},
+                           {"fragments", iteration.fragments},
+                           {"triangleEvaluations", iteration.triangleEvaluations},
+                           {"triangleEvaluationsPerSecond", throughput}};
+    writeTraceSpan(QString("submit ")+iteration.phase, SUBMISSION_THREAD,
+                   iteration.submitted, iteration.submissionTime, args);
+    const auto gpuStart = std::max(iteration.submitted, gpuTrackEnd_);
+    writeTraceSpan(iteration.phase, GPU_THREAD, gpuStart, iteration.gpuTime, args);
+    gpuTrackEnd_ = gpuStart + std::chrono::duration_cast<Clock::duration>(iteration.gpuTime);
+}
+
+void RenderProfiler::finishRender()
+{
+    if(!rendering_)
+        return;
+    rendering_=false;
+    wallTime_ = Clock::now() - renderStart_;
+    if(firstFrameTime_ < Clock::duration::zero())
+        firstFrameTime_ = wallTime_;
+    if(!log_ || csv_)
+        return;
+    writeTraceSpan("render", RENDER_THREAD, renderStart_, wallTime_,
+                   {{"description", description_},
+                    {"iterations", iterationCount_},
+                    {"gpuSeconds", std::chrono::duration<double>(gpuTime_).count()},
+                    {"firstFrameSeconds", seconds(firstFrameTime_)},
+                    {"triangleEvaluations", triangleEvaluations_}});
+}
+
+QString RenderProfiler::status() const
+{
+    const double gpuSeconds = std::chrono::duration<double>(gpuTime_).count();
+    const double throughput = gpuSeconds > 0 ? triangleEvaluations_ / gpuSeconds * 1e-9 : 0;
+    if(rendering_)
+    {
+        auto status = QObject::tr("Rendering sample %1 of %2: %3 iterations, the last one took %4 ms on the GPU, "
+                                  "%5 G triangle evaluations/s")
+                        .arg(lastSample_+1).arg(totalSamples_).arg(iterationCount_)
+                        .arg(std::chrono::duration<double, std::milli>(lastGPUTime_).count(), 0, 'f', 1)
+                        .arg(throughput, 0, 'f', 2);
+        if(firstFrameTime_ >= Clock::duration::zero())
+            status += QObject::tr(", first full frame after %1 s").arg(seconds(firstFrameTime_), 0, 'f', 2);
+        return status;
+    }
+    if(!iterationCount_)
+        return {};
+    return QObject::tr("Rendered in %1 s (%2 s on the GPU), first full frame after %3 s, "
+                       "%4 G triangle evaluations at %5 G/s")
+            .arg(seconds(wallTime_), 0, 'f', 2).arg(gpuSeconds, 0, 'f', 2)
+            .arg(seconds(firstFrameTime_), 0, 'f', 2)
+            .arg(triangleEvaluations_*1e-9, 0, 'f', 2).arg(throughput, 0, 'f', 2);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <QFile>
+#include <QString>
+#include <QJsonObject>
+
+// Statistics of the iterations of progressive rendering, summarized for the status bar. When
+// APERDIFF_PROFILE names a file, the iterations are also logged there: as CSV if the name ends
+// with .csv, otherwise as a Chrome trace, viewable in chrome://tracing or ui.perfetto.dev.
+class RenderProfiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    struct Iteration
+    {
+        const char* phase; // "image", "wedge", "pattern" or "gather"
+        int sample;
+        Clock::time_point submitted;
+        Clock::duration submissionTime;
+        std::chrono::nanoseconds gpuTime;
+        qint64 fragments; // px of the target newly covered
+        qint64 triangleEvaluations; // fragments × triangles × wavelengths
+        bool completesFrame; // the last iteration of the first pass over the whole image
+    };
+
+    RenderProfiler();
+    ~RenderProfiler();
+
+    // Name of the GPU and the driver, for the log
+    void setDevice(QString const& device);
+    void startRender(QString const& description, int totalSamples);
+    // Called when the GPU time of the iteration is known, in the order of submission
+    void addIteration(Iteration const& iteration);
+    void finishRender();
+
+    bool rendering() const { return rendering_; }
+    std::chrono::nanoseconds gpuTime() const { return gpuTime_; }
+    Clock::duration submissionTime() const { return submissionTime_; }
+    QString status() const;
+
+private:
+    void writeTraceEvent(QJsonObject event);
+    void writeTraceSpan(QString const& name, int thread, Clock::time_point start, Clock::duration duration,
+                        QJsonObject const& args);
+    double microseconds(Clock::time_point time) const;
+
+private:
+    Clock::time_point startTime_ = Clock::now(); // zero of the log timestamps
+    std::unique_ptr<QFile> log_;
+    bool csv_=false;
+    bool firstTraceEvent_=true;
+    QString device_;
+    int renderIndex_=0;
+
+    // Current or last render
+    bool rendering_=false;
+    QString description_;
+    int totalSamples_=0;
+    int lastSample_=0;
+    Clock::time_point renderStart_;
+    Clock::duration wallTime_{};
+    Clock::duration firstFrameTime_{-1};
+    int iterationCount_=0;
+    std::chrono::nanoseconds gpuTime_{};
+    std::chrono::nanoseconds lastGPUTime_{};
+    Clock::duration submissionTime_{};
+    qint64 triangleEvaluations_=0;
+    // The GPU timer only gives durations, so GPU events in the trace start either at their
+    // submission or at the end of the previous one, whichever is later
+    Clock::time_point gpuTrackEnd_;
+};
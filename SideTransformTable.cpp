@@ -0,0 +1,128 @@
+#include "SideTransformTable.hpp"
+#include <cmath>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <QtConcurrent>
+
+namespace
+{
+glm::vec2 complexMul(const glm::vec2 a, const glm::vec2 b)
+{
+    return glm::vec2(a.x*b.x - a.y*b.y, a.x*b.y + a.y*b.x);
+}
+glm::vec2 expI(const float phase)
+{
+    return glm::vec2(std::cos(phase), std::sin(phase));
+}
+}
+
+SideTransformTable::SideTransformTable(Parameters const& params)
+    : params_(params)
+{
+    const auto& geometry = *params.geometry;
+    const float PI = std::acos(-1.f);
+
+    std::vector<TriangleKernel::Triangle> triangles;
+    float totalArea = 0;
+    glm::vec2 weightedCenter(0);
+    for(int n=0; n<geometry.trianglesPerSide(); ++n)
+    {
+        const auto v1 = params.apertureRadius * geometry.triangleVertex1(n);
+        const auto v2 = params.apertureRadius * geometry.triangleVertex2(n);
+        const float area = TriangleKernel::triangleArea(glm::vec2(0), v1, v2);
+        triangles.push_back({v1, v2, area});
+        totalArea += area;
+        weightedCenter += area * (v1+v2)/3.f;
+    }
+    centroid_ = weightedCenter / totalArea;
+
+    const int radialSize = params.radialSize, angularSize = params.angularSize;
+    // The last texel center must reach maxWavenumber
+    step_ = glm::vec2(params.maxWavenumber / std::max(1, radialSize-1), 2*PI / angularSize);
+    data_.resize(size_t(radialSize)*angularSize);
+
+    std::vector<int> rows(angularSize);
+    std::iota(rows.begin(), rows.end(), 0);
+    QtConcurrent::blockingMap(rows, [&](const int row)
+    {
+        const float angle = (row+0.5f)*step_.y;
+        std::vector<float> kx(radialSize), ky(radialSize), re(radialSize), im(radialSize);
+        for(int i=0; i<radialSize; ++i)
+        {
+            const float radius = (i+0.5f)*step_.x;
+            kx[i] = radius*std::cos(angle);
+            ky[i] = radius*std::sin(angle);
+        }
+        kernel_.evaluate(triangles.data(), triangles.size(), kx.data(), ky.data(), radialSize, re.data(), im.data());
+        const auto out = data_.begin() + size_t(row)*radialSize;
+        for(int i=0; i<radialSize; ++i)
+            out[i] = complexMul(glm::vec2(re[i], im[i]), expI(kx[i]*centroid_.x + ky[i]*centroid_.y));
+    });
+}
+
+glm::vec2 SideTransformTable::lookup(const float radius, const float angle) const
+{
+    // GL_LINEAR filtering with CLAMP_TO_EDGE radially and REPEAT angularly
+    const int radialSize = params_.radialSize, angularSize = params_.angularSize;
+    const float x = std::clamp(radius/step_.x - 0.5f, 0.f, radialSize-1.f);
+    const float y = angle/step_.y - 0.5f;
+    const int i0 = std::min(int(x), std::max(0, radialSize-2));
+    const int i1 = std::min(i0+1, radialSize-1);
+    const float fx = x - i0;
+    const float yFloor = std::floor(y);
+    const float fy = y - yFloor;
+    const auto wrap = [=](const int j){ return (j%angularSize + angularSize)%angularSize; };
+    const int j0 = wrap(int(yFloor)), j1 = wrap(int(yFloor)+1);
+    const auto at = [&](const int i, const int j){ return data_[size_t(j)*radialSize+i]; };
+    return (1-fy)*((1-fx)*at(i0,j0) + fx*at(i1,j0)) +
+              fy *((1-fx)*at(i0,j1) + fx*at(i1,j1));
+}
+
+glm::vec2 SideTransformTable::transform(const glm::vec2 k) const
+{
+    const float PI = std::acos(-1.f);
+    const int sides = sideCount();
+    const float radius = glm::length(k);
+    const float angle = radius>0 ? std::atan2(k.y, k.x) : 0;
+    glm::vec2 sum(0);
+    for(int side=0; side<sides; ++side)
+    {
+        const float rotation = 2*PI*side/sides;
+        const float c = std::cos(rotation), s = std::sin(rotation);
+        const glm::vec2 sideCentroid(c*centroid_.x - s*centroid_.y, s*centroid_.x + c*centroid_.y);
+        sum += complexMul(lookup(radius, angle-rotation), expI(-dot(k, sideCentroid)));
+    }
+    return sum;
+}
+
+float SideTransformTable::maxInterpolationError(const int sampleCount) const
+{
+    const auto& geometry = *params_.geometry;
+    std::vector<TriangleKernel::Triangle> triangles;
+    float totalArea = 0;
+    for(int n=0; n<geometry.triangleCount(); ++n)
+    {
+        const auto v1 = params_.apertureRadius * geometry.triangleVertex1(n);
+        const auto v2 = params_.apertureRadius * geometry.triangleVertex2(n);
+        triangles.push_back({v1, v2, TriangleKernel::triangleArea(glm::vec2(0), v1, v2)});
+        totalArea += triangles.back().area;
+    }
+
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> unit(0, 1);
+    std::vector<float> kx(sampleCount), ky(sampleCount), re(sampleCount), im(sampleCount);
+    for(int i=0; i<sampleCount; ++i)
+    {
+        // Uniformly distributed over the disk of the table
+        const float radius = params_.maxWavenumber*std::sqrt(unit(gen));
+        const float angle = 2*std::acos(-1.f)*unit(gen);
+        kx[i] = radius*std::cos(angle);
+        ky[i] = radius*std::sin(angle);
+    }
+    kernel_.evaluate(triangles.data(), triangles.size(), kx.data(), ky.data(), sampleCount, re.data(), im.data());
+    float maxError = 0;
+    for(int i=0; i<sampleCount; ++i)
+        maxError = std::max(maxError, glm::length(transform(glm::vec2(kx[i], ky[i])) - glm::vec2(re[i], im[i])));
+    return maxError / std::abs(totalArea);
+}
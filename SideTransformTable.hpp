@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "TriangleKernel.hpp"
+#include "ApertureGeometry.hpp"
+
+// Fourier transform of the triangles of one side of the aperture, tabulated in polar
+// coordinates (|k|, angle of k). The other sides are the first one rotated by multiples of
+// 2π/sideCount, so the transform of the whole aperture is the sum of sideCount lookups at
+// rotated k. The table stores the transform multiplied by exp(ik·centroid), which slows
+// down its oscillation and makes the interpolation error several times smaller.
+class SideTransformTable
+{
+public:
+    struct Parameters
+    {
+        std::shared_ptr<const ApertureGeometry> geometry;
+        float apertureRadius=1; // mm
+        float maxWavenumber=1; // largest |k| to be looked up, mm^-1
+        int radialSize=1024, angularSize=1024; // texels
+
+        bool operator==(Parameters const& other) const
+        {
+            return geometry==other.geometry && apertureRadius==other.apertureRadius &&
+                   maxWavenumber==other.maxWavenumber && radialSize==other.radialSize &&
+                   angularSize==other.angularSize;
+        }
+        bool operator!=(Parameters const& other) const { return !(*this==other); }
+    };
+
+    // Computes the table, using all cores
+    explicit SideTransformTable(Parameters const& params);
+
+    Parameters const& parameters() const { return params_; }
+    int sideCount() const { return params_.geometry->symmetryOrder(); }
+    // Complex values, row by row, each row being one angle. Texel (i,j) holds the value at
+    // |k|=(i+0.5)*step().x, angle=(j+0.5)*step().y, as the texture lookup in the shader assumes.
+    std::vector<glm::vec2> const& data() const { return data_; }
+    glm::vec2 step() const { return step_; } // mm^-1 and radians per texel
+    glm::vec2 centroid() const { return centroid_; } // mm, of the first side's triangles
+
+    // Transform of the whole aperture reconstructed from the table with bilinear
+    // interpolation, the same way as the shader does it
+    glm::vec2 transform(glm::vec2 k) const;
+    // Maximum difference between transform() and the direct evaluation at random k within
+    // the range of the table, relative to the transform at k=0
+    float maxInterpolationError(int sampleCount=2048) const;
+
+private:
+    glm::vec2 lookup(float radius, float angle) const;
+
+private:
+    Parameters params_;
+    TriangleKernel kernel_;
+    std::vector<glm::vec2> data_;
+    glm::vec2 step_;
+    glm::vec2 centroid_;
+};
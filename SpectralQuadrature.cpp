@@ -0,0 +1,269 @@
+#include "SpectralQuadrature.hpp"
+#include <cmath>
+#include <algorithm>
+#include <QFile>
+#include <QObject>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QTextStream>
+#include <QRegularExpression>
+#include "cie-d65.hpp"
+#include "cie-xyzw-functions.hpp"
+
+namespace
+{
+constexpr int tableMin=360, tableMax=830; // nm, same as the color matching functions
+
+std::vector<float> tabulate(float (*const power)(float))
+{
+    std::vector<float> table;
+    for(int wl=tableMin; wl<=tableMax; ++wl)
+        table.push_back(power(wl));
+    return table;
+}
+
+double luminance(std::vector<float> const& power)
+{
+    double sum=0;
+    for(int wl=SpectralQuadrature::minWavelength; wl<=SpectralQuadrature::maxWavelength; ++wl)
+        sum += power[wl-tableMin] * wavelengthToXYZW(wl).y;
+    return sum;
+}
+
+// Nodes and weights on [-1,1], found by Newton's method from the usual initial guesses
+std::vector<std::pair<double,double>> gaussLegendre(const int count)
+{
+    const double PI=std::acos(-1.);
+    std::vector<std::pair<double,double>> nodes(count);
+    for(int i=0; i<(count+1)/2; ++i)
+    {
+        double x=std::cos(PI*(i+0.75)/(count+0.5)), derivative=0;
+        for(int iteration=0; iteration<100; ++iteration)
+        {
+            double p0=1, p1=x;
+            for(int n=2; n<=count; ++n)
+            {
+                const double p2=((2*n-1)*x*p1-(n-1)*p0)/n;
+                p0=p1;
+                p1=p2;
+            }
+            derivative=count*(x*p1-p0)/(x*x-1);
+            const double dx=p1/derivative;
+            x-=dx;
+            if(std::abs(dx)<1e-15) break;
+        }
+        const double weight=2/((1-x*x)*derivative*derivative);
+        nodes[i]={-x, weight};
+        nodes[count-1-i]={x, weight};
+    }
+    return nodes;
+}
+
+std::vector<SpectralQuadrature::Node> importanceNodes(SourceSpectrum const& spectrum, const int count)
+{
+    using namespace glm;
+    // The integrand is taken as constant within each cell, so the bins can split cells
+    constexpr int cellsPerNm=10;
+    constexpr double h=1./cellsPerNm;
+    const int cellCount=(SpectralQuadrature::maxWavelength-SpectralQuadrature::minWavelength)*cellsPerNm;
+    std::vector<dvec4> weights(cellCount);
+    std::vector<double> density(cellCount);
+    double total=0;
+    for(int cell=0; cell<cellCount; ++cell)
+    {
+        const float wl=SpectralQuadrature::minWavelength+(cell+0.5)*h;
+        weights[cell]=dvec4(spectrum(wl)*wavelengthToXYZW(wl));
+        density[cell]=weights[cell].x+weights[cell].y+weights[cell].z;
+        total+=density[cell]*h;
+    }
+    if(!(total>0))
+    {
+        std::fill(density.begin(), density.end(), 1.);
+        total=cellCount*h;
+    }
+
+    std::vector<SpectralQuadrature::Node> nodes;
+    int cell=0;
+    double cellUsed=0; // fraction of the cell already in previous bins
+    for(int bin=0; bin<count; ++bin)
+    {
+        const bool last = bin==count-1;
+        double needed=total/count;
+        dvec4 weight(0);
+        double mass=0, moment=0;
+        while(cell<cellCount)
+        {
+            const double cellMass=density[cell]*h;
+            double fraction=1-cellUsed;
+            if(!last && cellMass*fraction > needed)
+                fraction=needed/cellMass;
+            const double start=SpectralQuadrature::minWavelength+(cell+cellUsed)*h, length=fraction*h;
+            weight += weights[cell]*length;
+            mass += density[cell]*length;
+            moment += density[cell]*length*(start+length/2);
+            needed -= cellMass*fraction;
+            cellUsed += fraction;
+            if(cellUsed > 1-1e-9)
+            {
+                ++cell;
+                cellUsed=0;
+            }
+            if(!last && needed <= total*1e-12)
+                break;
+        }
+        const double position=SpectralQuadrature::minWavelength+(cell+cellUsed)*h;
+        nodes.push_back({float(mass>0 ? moment/mass : position), vec4(weight)});
+    }
+    return nodes;
+}
+}
+
+SourceSpectrum::SourceSpectrum(QString const& key, std::vector<float> power)
+    : key_(key)
+    , power_(std::move(power))
+{
+    const double scale = luminance(tabulate(illuminantD65)) / luminance(power_);
+    if(std::isfinite(scale))
+    {
+        for(auto& p : power_)
+            p *= scale;
+    }
+}
+
+SourceSpectrum SourceSpectrum::d65()
+{
+    return SourceSpectrum("D65", tabulate(illuminantD65));
+}
+
+SourceSpectrum SourceSpectrum::blackbody(const double temperature)
+{
+    // Planck's law up to a constant factor, with hc/k in nm·K
+    constexpr double hcOverK=1.438777e7;
+    std::vector<float> power;
+    for(int wl=tableMin; wl<=tableMax; ++wl)
+        power.push_back(std::pow(wl/500., -5) / std::expm1(hcOverK/(wl*temperature)));
+    return SourceSpectrum(QString("blackbody %1 K").arg(temperature), std::move(power));
+}
+
+std::optional<SourceSpectrum> SourceSpectrum::fromCSV(QString const& path, QString& error)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly|QIODevice::Text))
+    {
+        error = file.errorString();
+        return std::nullopt;
+    }
+    std::vector<std::pair<double,double>> points;
+    QTextStream stream(&file);
+    const QRegularExpression separator("[,;\\s]+");
+    while(!stream.atEnd())
+    {
+        const auto fields = stream.readLine().trimmed().split(separator);
+        if(fields.size() < 2) continue;
+        bool wlOK=false, powerOK=false;
+        const double wavelength = fields[0].toDouble(&wlOK);
+        const double power = fields[1].toDouble(&powerOK);
+        if(wlOK && powerOK && std::isfinite(wavelength) && std::isfinite(power))
+            points.emplace_back(wavelength, std::max(power, 0.));
+    }
+    if(points.size() < 2)
+    {
+        error = QObject::tr("found fewer than two lines of wavelength and power");
+        return std::nullopt;
+    }
+    std::sort(points.begin(), points.end());
+
+    // Linear interpolation, zero outside of the data
+    std::vector<float> power;
+    for(int wl=tableMin; wl<=tableMax; ++wl)
+    {
+        const auto next = std::lower_bound(points.begin(), points.end(), std::make_pair(double(wl), -1.));
+        if(next==points.end() || (next==points.begin() && next->first!=wl))
+        {
+            power.push_back(0);
+            continue;
+        }
+        if(next->first==wl)
+        {
+            power.push_back(next->second);
+            continue;
+        }
+        const auto prev = next-1;
+        const double alpha = (wl-prev->first)/(next->first-prev->first);
+        power.push_back(prev->second*(1-alpha)+next->second*alpha);
+    }
+    if(!(luminance(power) > 0))
+    {
+        error = QObject::tr("the spectrum has no power between %1 and %2 nm")
+                    .arg(SpectralQuadrature::minWavelength).arg(SpectralQuadrature::maxWavelength);
+        return std::nullopt;
+    }
+    const QFileInfo info(path);
+    return SourceSpectrum("file "+info.canonicalFilePath()+" "+info.lastModified().toString(Qt::ISODateWithMs),
+                          std::move(power));
+}
+
+float SourceSpectrum::operator()(const float wavelength) const
+{
+    if(wavelength<tableMin || wavelength>tableMax)
+        return 0;
+    const float fractionalIndex = wavelength-tableMin;
+    const unsigned index = std::min(unsigned(fractionalIndex), unsigned(power_.size()-2));
+    const float alpha = fractionalIndex-index;
+    return power_[index]*(1-alpha)+power_[index+1]*alpha;
+}
+
+std::vector<SpectralQuadrature::Node> SpectralQuadrature::compute(SourceSpectrum const& spectrum, const Rule rule, const int count)
+{
+    if(count <= 1)
+        return {{610, 4000.f*wavelengthToXYZW(610)}};
+
+    std::vector<Node> nodes;
+    constexpr float range=maxWavelength-minWavelength;
+    switch(rule)
+    {
+    case Rule::Trapezoid:
+        for(int i=0; i<count; ++i)
+        {
+            const float wl = minWavelength+range*i/(count-1);
+            const float weight = (i==0 || i==count-1 ? 0.5f : 1.f) * range/(count-1);
+            nodes.push_back({wl, weight*spectrum(wl)*wavelengthToXYZW(wl)});
+        }
+        break;
+    case Rule::GaussLegendre:
+        for(const auto& [x, w] : gaussLegendre(count))
+        {
+            const float wl = minWavelength+range*(x+1)/2;
+            const float weight = w*range/2;
+            nodes.push_back({wl, weight*spectrum(wl)*wavelengthToXYZW(wl)});
+        }
+        break;
+    case Rule::Importance:
+        nodes = importanceNodes(spectrum, count);
+        break;
+    }
+    return nodes;
+}
+
+std::vector<SpectralQuadrature::Node> const& SpectralQuadrature::nodes(SourceSpectrum const& spectrum, const Rule rule, const int count)
+{
+    const auto key = std::make_tuple(spectrum.key(), rule, count);
+    const auto it = tables_.find(key);
+    if(it != tables_.end())
+        return it->second;
+    // Dragging the wavelength count through its range would otherwise accumulate lots of them
+    if(tables_.size() >= 64)
+        tables_.clear();
+    return tables_[key] = compute(spectrum, rule, count);
+}
+
+QString SpectralQuadrature::name(const Rule rule)
+{
+    switch(rule)
+    {
+    case Rule::Trapezoid: return QObject::tr("Evenly spaced");
+    case Rule::GaussLegendre: return QObject::tr(u8"Gauss–Legendre");
+    case Rule::Importance: return QObject::tr("Importance-placed");
+    }
+    return {};
+}
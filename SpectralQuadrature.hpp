@@ -0,0 +1,60 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <optional>
+#include <QString>
+#include <glm/glm.hpp>
+
+// Relative spectral power distribution of the light source. All spectra are scaled to the
+// luminance of CIE D65 over the rendered range, so that switching them keeps the exposure.
+class SourceSpectrum
+{
+public:
+    static SourceSpectrum d65();
+    static SourceSpectrum blackbody(double temperature); // K
+    // Reads lines of wavelength in nm and relative power, separated by commas, semicolons or
+    // whitespace. Lines that don't start with two numbers, like headers, are skipped.
+    static std::optional<SourceSpectrum> fromCSV(QString const& path, QString& error);
+
+    float operator()(float wavelength) const;
+    // Identifies the spectrum for the caches
+    QString const& key() const { return key_; }
+
+private:
+    SourceSpectrum(QString const& key, std::vector<float> power);
+
+private:
+    QString key_;
+    std::vector<float> power_; // at 1 nm steps from the start of the CIE tables
+};
+
+// Nodes and weights for the integral of SPD(λ)·x̄ȳz̄(λ)·f(λ) over the visible range, where f is
+// the diffraction pattern. Evenly spaced nodes need hundreds of wavelengths to hide color
+// banding; Gauss–Legendre and importance-placed nodes converge with a few dozen.
+class SpectralQuadrature
+{
+public:
+    enum class Rule
+    {
+        Trapezoid,     // evenly spaced nodes
+        GaussLegendre,
+        Importance,    // each node takes an equal share of SPD·(x̄+ȳ+z̄), sitting at its centroid
+    };
+    struct Node
+    {
+        float wavelength; // nm
+        glm::vec4 weight; // XYZW
+    };
+    static constexpr float minWavelength=400, maxWavelength=700; // nm
+
+    // A single node shows the pattern at 610 nm, without the source spectrum
+    static std::vector<Node> compute(SourceSpectrum const& spectrum, Rule rule, int count);
+    // Same as compute(), but keeps the tables computed so far
+    std::vector<Node> const& nodes(SourceSpectrum const& spectrum, Rule rule, int count);
+    static QString name(Rule rule);
+
+private:
+    std::map<std::tuple<QString, Rule, int>, std::vector<Node>> tables_;
+};
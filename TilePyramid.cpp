@@ -0,0 +1,51 @@
+#include "TilePyramid.hpp"
+
+TilePyramid::TilePyramid(const int slotCount)
+    : slotCount_(slotCount)
+{
+    for(int slot=slotCount-1; slot>=0; --slot)
+        freeSlots_.push_back(slot);
+}
+
+void TilePyramid::setKey(QByteArray const& key)
+{
+    if(key == key_)
+        return;
+    key_ = key;
+    for(const auto& [id, slot] : usage_)
+        freeSlots_.push_back(slot);
+    usage_.clear();
+    tiles_.clear();
+}
+
+int TilePyramid::find(TileID const& id)
+{
+    const auto it = tiles_.find(id);
+    if(it == tiles_.end())
+        return -1;
+    usage_.splice(usage_.begin(), usage_, it->second);
+    return it->second->second;
+}
+
+int TilePyramid::insert(TileID const& id)
+{
+    const int existing = find(id);
+    if(existing >= 0)
+        return existing;
+
+    int slot;
+    if(!freeSlots_.empty())
+    {
+        slot = freeSlots_.back();
+        freeSlots_.pop_back();
+    }
+    else
+    {
+        slot = usage_.back().second;
+        tiles_.erase(usage_.back().first);
+        usage_.pop_back();
+    }
+    usage_.emplace_front(id, slot);
+    tiles_[id] = usage_.begin();
+    return slot;
+}
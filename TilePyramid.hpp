@@ -0,0 +1,42 @@
+#pragma once
+
+#include <map>
+#include <list>
+#include <tuple>
+#include <vector>
+#include <QByteArray>
+
+// Bookkeeping of finished tiles of the image, kept in a texture atlas on the GPU. The tiles form
+// a quadtree pyramid: at zoom level L the pattern has 2^L times the pixels per unit length of
+// level 0, and tile (x,y) covers pixels [x*tileSize, (x+1)*tileSize) of it along each axis,
+// counted from the center of the pattern. The atlas has a fixed number of slots; when all of
+// them are taken, the least recently used tile gives way.
+class TilePyramid
+{
+public:
+    static constexpr int tileSize=128; // px
+    struct TileID
+    {
+        int level, x, y;
+        bool operator<(TileID const& other) const
+        { return std::tie(level, x, y) < std::tie(other.level, other.x, other.y); }
+    };
+
+    explicit TilePyramid(int slotCount);
+
+    // Everything the tiles depend on, apart from their position. A different key drops all tiles.
+    void setKey(QByteArray const& key);
+    // Slot of the tile, or -1 if it's absent. Marks the tile as recently used.
+    int find(TileID const& id);
+    // Slot to store a new tile into, taken from the least recently used tile if there's no free one
+    int insert(TileID const& id);
+    int slotCount() const { return slotCount_; }
+
+private:
+    int slotCount_;
+    QByteArray key_;
+    // Most recently used first
+    std::list<std::pair<TileID, int>> usage_;
+    std::map<TileID, std::list<std::pair<TileID, int>>::iterator> tiles_;
+    std::vector<int> freeSlots_;
+};
@@ -0,0 +1,78 @@
+#include "TiledCPURenderer.hpp"
+#include <algorithm>
+#include <QThreadPool>
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+TiledCPURenderer::TiledCPURenderer(QObject* parent)
+    : QObject(parent)
+{
+    connect(&watcher_, &QFutureWatcher<void>::progressValueChanged, this, &TiledCPURenderer::progressed);
+    connect(&watcher_, &QFutureWatcher<void>::finished, this, &TiledCPURenderer::onFinished);
+}
+
+TiledCPURenderer::~TiledCPURenderer()
+{
+    cancel();
+}
+
+void TiledCPURenderer::cancel()
+{
+    watcher_.cancel();
+    watcher_.waitForFinished();
+}
+
+void TiledCPURenderer::start(CPUGlareRenderer::Parameters const& params, const int width, const int height)
+{
+    // The tiles in flight read the engine, so it can't be altered until they finish
+    cancel();
+
+    engine_.setParameters(params);
+    engine_.setImageSize(width, height);
+    {
+        QMutexLocker lock(&mutex_);
+        luminance_.assign(size_t(width)*height, glm::vec4(0));
+    }
+    tiles_ = CPUGlareRenderer::tiles(width, height, tileSize);
+
+    timer_.start();
+    watcher_.setFuture(QtConcurrent::map(tiles_, [this](CPUGlareRenderer::Tile const& tile){ renderTile(tile); }));
+}
+
+void TiledCPURenderer::renderTile(CPUGlareRenderer::Tile const& tile)
+{
+    // The image is read while being rendered, so the partial sums stay out of it
+    std::vector<glm::vec4> local(size_t(tile.width)*tile.height);
+    engine_.renderTile(tile, local.data(), tile.width);
+
+    QMutexLocker lock(&mutex_);
+    for(int row=0; row<tile.height; ++row)
+    {
+        const auto src = local.begin()+size_t(row)*tile.width;
+        std::copy(src, src+tile.width, luminance_.begin()+size_t(tile.y+row)*engine_.width()+tile.x);
+    }
+}
+
+void TiledCPURenderer::onFinished()
+{
+    if(watcher_.isCanceled()) return;
+
+    seconds_ = timer_.nsecsElapsed()*1e-9;
+    const double megapixels = engine_.width()*engine_.height()*1e-6;
+    throughput_ = megapixels * engine_.parameters().wavelengths.size() / seconds_;
+    emit finished();
+}
+
+QString TiledCPURenderer::status() const
+{
+    return tr("Rendered on the CPU in %1 s on %2 threads (%3 kernel, %4 formula), %5 Mpixel*wavelength/s")
+            .arg(seconds_, 0, 'f', 2).arg(QThreadPool::globalInstance()->maxThreadCount())
+            .arg(TriangleKernel::name(engine_.kernel().isa())).arg(TriangleKernel::name(engine_.kernel().formula()))
+            .arg(throughput_, 0, 'f', 1);
+}
+
+std::vector<glm::vec4> TiledCPURenderer::luminance() const
+{
+    QMutexLocker lock(&mutex_);
+    return luminance_;
+}
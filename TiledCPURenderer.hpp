@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include <QMutex>
+#include <QObject>
+#include <QFutureWatcher>
+#include <QElapsedTimer>
+#include "CPUGlareRenderer.hpp"
+
+// Runs CPUGlareRenderer on all cores. The image is split into small tiles, which the
+// threads of the global QThreadPool pick up one after another, so that a thread that
+// got cheap tiles simply takes more of them. Each tile accumulates all wavelengths and
+// samples in its own buffer and touches the shared image only once, when it's done.
+class TiledCPURenderer : public QObject
+{
+    Q_OBJECT
+public:
+    // 32×32 XYZW floats take 16 KiB, so a tile stays in L1/L2 cache while being accumulated
+    static constexpr int tileSize=32;
+
+    TiledCPURenderer(QObject* parent=nullptr);
+    ~TiledCPURenderer();
+
+    // Cancels the current render, if any, and starts a new one
+    void start(CPUGlareRenderer::Parameters const& params, int width, int height);
+    void cancel();
+    bool isRunning() const { return watcher_.isRunning(); }
+
+    int width() const { return engine_.width(); }
+    int height() const { return engine_.height(); }
+    CPUGlareRenderer const& engine() const { return engine_; }
+    // Snapshot of the (possibly partially rendered) image, in the layout of CPUGlareRenderer
+    std::vector<glm::vec4> luminance() const;
+    // Throughput of the last finished render
+    double megapixelWavelengthsPerSecond() const { return throughput_; }
+    // Time and throughput of the last finished render, for the status bar
+    QString status() const;
+
+signals:
+    void progressed();
+    void finished();
+
+private:
+    void renderTile(CPUGlareRenderer::Tile const& tile);
+    void onFinished();
+
+private:
+    CPUGlareRenderer engine_;
+    std::vector<CPUGlareRenderer::Tile> tiles_;
+    QFutureWatcher<void> watcher_;
+    QElapsedTimer timer_;
+    double seconds_=0;
+    double throughput_=0;
+
+    mutable QMutex mutex_;
+    std::vector<glm::vec4> luminance_;
+};
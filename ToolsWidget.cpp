@@ -1,5 +1,11 @@
 #include "ToolsWidget.hpp"
 #include "Manipulator.hpp"
+#include <QLabel>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QFileInfo>
+#include <QFileDialog>
+#include <QMessageBox>
 #include <QPushButton>
 
 Manipulator* addManipulator(QVBoxLayout*const layout, ToolsWidget*const tools,
@@ -31,6 +37,80 @@ ToolsWidget::ToolsWidget(QWidget* parent)
     curvatureRadius_ = addManipulator(layout, this, tr(u8"Ra&dius of curvature of side"), 1, 50, 3, 2, tr(u8" Rₐₚₜ"), true);
     sampleCount_ = addManipulator(layout, this, tr(u8"Sa&mples per pixel side"), 1, 19, 1, 0);
     wavelengthCount_ = addManipulator(layout, this, tr(u8"Number of &wavelengths"), 1, 9999, 256, 0, "", true);
+    {
+        const auto row = new QHBoxLayout;
+        const auto label = new QLabel(tr("Spectral &quadrature"));
+        spectralRule_ = new QComboBox;
+        for(const auto rule : {SpectralQuadrature::Rule::Trapezoid, SpectralQuadrature::Rule::GaussLegendre,
+                               SpectralQuadrature::Rule::Importance})
+            spectralRule_->addItem(SpectralQuadrature::name(rule), int(rule));
+        spectralRule_->setToolTip(tr("How the wavelengths are placed and weighted. Gauss–Legendre and importance-placed "
+                                     "nodes converge to the right color with fewer wavelengths where fringes are wide; "
+                                     "far out in the pattern, where fringes of neighboring wavelengths separate, "
+                                     "evenly spaced ones band the least."));
+        label->setBuddy(spectralRule_);
+        row->addWidget(label);
+        row->addWidget(spectralRule_, 1);
+        layout->addLayout(row);
+        connect(spectralRule_, qOverload<int>(&QComboBox::currentIndexChanged), this, &ToolsWidget::settingChanged);
+    }
+    {
+        const auto row = new QHBoxLayout;
+        const auto label = new QLabel(tr("Li&ght source"));
+        lightSource_ = new QComboBox;
+        lightSource_->addItem(tr("Daylight (D65)"));
+        lightSource_->addItem(tr("Blackbody"));
+        lightSource_->addItem(tr(u8"From file…"));
+        label->setBuddy(lightSource_);
+        row->addWidget(label);
+        row->addWidget(lightSource_, 1);
+        layout->addLayout(row);
+        connect(lightSource_, qOverload<int>(&QComboBox::activated), this, &ToolsWidget::onLightSourceChosen);
+    }
+    temperature_ = addManipulator(layout, this, tr(u8"Blackbody temperat&ure"), 1000, 20000, 5800, 0, tr(" K"), true);
+    temperature_->setEnabled(false);
+    connect(temperature_, &Manipulator::valueChanged, this, &ToolsWidget::updateSourceSpectrum);
+    useSymmetry_ = new QCheckBox(tr("Compute only a s&ymmetric wedge of the pattern"));
+    useSymmetry_->setChecked(true);
+    useSymmetry_->setToolTip(tr("The pattern of a regular aperture repeats after rotation and reflection, so only a "
+                                "fraction of it needs computing. The rest is filled by resampling, which is much "
+                                "faster but blurs fringes finer than a pixel."));
+    layout->addWidget(useSymmetry_);
+    connect(useSymmetry_, &QCheckBox::toggled, this, &ToolsWidget::settingChanged);
+    monochromaticPattern_ = new QCheckBox(tr("Compute one m&onochromatic pattern for all wavelengths"));
+    monochromaticPattern_->setToolTip(tr("The pattern at each wavelength is the same function of the wave vector, only "
+                                         "scaled radially. Computing it once and integrating its rescaled copies over "
+                                         "the spectrum is much faster with many wavelengths, but the fringes are "
+                                         "interpolated."));
+    layout->addWidget(monochromaticPattern_);
+    connect(monochromaticPattern_, &QCheckBox::toggled, this, &ToolsWidget::settingChanged);
+    useEdgeFormula_ = new QCheckBox(tr("Sum the transform over aperture &edges"));
+    useEdgeFormula_->setChecked(true);
+    useEdgeFormula_->setToolTip(tr("Compute the Fourier transform of the aperture as a sum over its edges, which "
+                                   "needs fewer sines and cosines than the sum over triangles fanned from the center."));
+    layout->addWidget(useEdgeFormula_);
+    connect(useEdgeFormula_, &QCheckBox::toggled, this, &ToolsWidget::settingChanged);
+    useSideTable_ = new QCheckBox(tr("Look up the transform of each side in a &table"));
+    useSideTable_->setToolTip(tr("All sides of the aperture are the same up to rotation, so the transform of one side "
+                                 "can be tabulated once and looked up for every side. This replaces the sum over "
+                                 "all arc points with a lookup per side, at the cost of interpolation error."));
+    layout->addWidget(useSideTable_);
+    connect(useSideTable_, &QCheckBox::toggled, this, &ToolsWidget::settingChanged);
+    sideTableSize_ = addManipulator(layout, this, tr(u8"Side table si&ze"), 64, 8192, 2048, 0, tr(" texels"), true);
+    sideTableError_ = new QLabel;
+    layout->addWidget(sideTableError_);
+    adaptiveSampling_ = new QCheckBox(tr("&Stop sampling pixels that have converged"));
+    adaptiveSampling_->setChecked(true);
+    adaptiveSampling_->setToolTip(tr("Samples per pixel side then sets the maximum. Each pixel stops getting samples "
+                                     "once the estimated error of its mean falls below the tolerance, so smooth parts "
+                                     "of the pattern take few samples while fine fringes get the most."));
+    layout->addWidget(adaptiveSampling_);
+    connect(adaptiveSampling_, &QCheckBox::toggled, this, &ToolsWidget::settingChanged);
+    samplingTolerance_ = addManipulator(layout, this, tr(u8"Sampling to&lerance"), 0.01, 10, 0.5, 2, "%", true);
+    showSampleCounts_ = new QCheckBox(tr("S&how the number of samples per pixel"));
+    showSampleCounts_->setToolTip(tr("Blue is one sample, red is the maximum, on a logarithmic scale"));
+    layout->addWidget(showSampleCounts_);
+    connect(showSampleCounts_, &QCheckBox::toggled, this, &ToolsWidget::settingChanged);
 #if QT_VERSION >= QT_VERSION_CHECK(6,2,0) // Requires QImage::Format_RGBX32FPx4
     saveBtn_ = new QPushButton(tr("Sa&ve image"));
     layout->addWidget(saveBtn_);
@@ -38,4 +118,109 @@ ToolsWidget::ToolsWidget(QWidget* parent)
 #endif
 
     layout->addStretch();
+
+    updateSourceSpectrum();
+}
+
+SpectralQuadrature::Rule ToolsWidget::spectralRule() const
+{
+    return SpectralQuadrature::Rule(spectralRule_->currentData().toInt());
+}
+
+void ToolsWidget::onLightSourceChosen(const int index)
+{
+    if(index == FileSource)
+    {
+        const auto path = QFileDialog::getOpenFileName(this, tr("Load source spectrum"), {},
+                                                       tr("Spectral power distributions (*.csv *.txt);;All files (*)"));
+        QString error;
+        const auto spectrum = path.isNull() ? std::nullopt : SourceSpectrum::fromCSV(path, error);
+        if(spectrum)
+        {
+            fileSpectrum_ = std::make_shared<const SourceSpectrum>(*spectrum);
+            lightSource_->setItemText(FileSource, QFileInfo(path).fileName());
+        }
+        else
+        {
+            if(!path.isNull())
+                QMessageBox::critical(this, tr("Failed to load spectrum"),
+                                      tr("Failed to load spectrum from %1: %2").arg(path).arg(error));
+            // Keep whatever was chosen before
+            if(!fileSpectrum_)
+                lightSource_->setCurrentIndex(temperature_->isEnabled() ? BlackbodySource : DaylightSource);
+        }
+    }
+    updateSourceSpectrum();
+}
+
+void ToolsWidget::updateSourceSpectrum()
+{
+    const int source = lightSource_->currentIndex();
+    temperature_->setEnabled(source == BlackbodySource);
+    std::shared_ptr<const SourceSpectrum> spectrum;
+    switch(source)
+    {
+    case BlackbodySource:
+        spectrum = std::make_shared<const SourceSpectrum>(SourceSpectrum::blackbody(temperature_->value()));
+        break;
+    case FileSource:
+        spectrum = fileSpectrum_;
+        break;
+    default:
+        spectrum = std::make_shared<const SourceSpectrum>(SourceSpectrum::d65());
+        break;
+    }
+    if(sourceSpectrum_ && spectrum->key() == sourceSpectrum_->key())
+        return;
+    sourceSpectrum_ = spectrum;
+    emit settingChanged();
+}
+
+bool ToolsWidget::useSymmetry() const
+{
+    return useSymmetry_->isChecked();
+}
+
+bool ToolsWidget::monochromaticPattern() const
+{
+    return monochromaticPattern_->isChecked();
+}
+
+bool ToolsWidget::useEdgeFormula() const
+{
+    return useEdgeFormula_->isChecked();
+}
+
+bool ToolsWidget::useSideTable() const
+{
+    return useSideTable_->isChecked();
+}
+
+bool ToolsWidget::adaptiveSampling() const
+{
+    return adaptiveSampling_->isChecked();
+}
+
+bool ToolsWidget::showSampleCounts() const
+{
+    return showSampleCounts_->isChecked();
+}
+
+void ToolsWidget::setSideTableStatus(const double relativeError, const qint64 buildTime)
+{
+    sideTableError_->setText(tr("Side table interpolation error: %1, built in %2 ms")
+                                .arg(relativeError, 0, 'g', 2).arg(buildTime));
+}
+
+ApertureGeometry::Parameters ToolsWidget::apertureGeometryParameters() const
+{
+    return {pointCount(), arcPointCount(), curvatureRadius(), globalRotationAngle()};
+}
+
+std::shared_ptr<const ApertureGeometry> ToolsWidget::apertureGeometry() const
+{
+    const auto params = apertureGeometryParameters();
+    if(!apertureGeometry_ || apertureGeometry_->parameters() != params)
+        apertureGeometry_ = std::make_shared<const ApertureGeometry>(params);
+    return apertureGeometry_;
 }
@@ -1,9 +1,15 @@
 #pragma once
 
 #include <cmath>
+#include <memory>
 #include <QDockWidget>
 #include "Manipulator.hpp"
+#include "ApertureGeometry.hpp"
+#include "SpectralQuadrature.hpp"
 
+class QLabel;
+class QCheckBox;
+class QComboBox;
 class QPushButton;
 class ToolsWidget : public QDockWidget
 {
@@ -21,11 +27,36 @@ public:
     double curvatureRadius() const { return curvatureRadius_->value(); }
     int sampleCount() const { return sampleCount_->value(); }
     int wavelengthCount() const { return wavelengthCount_->value(); }
+    SpectralQuadrature::Rule spectralRule() const;
+    // Replaced only when the choice of source changes; the pointer can be compared to detect that
+    std::shared_ptr<const SourceSpectrum> sourceSpectrum() const { return sourceSpectrum_; }
+    bool useSymmetry() const;
+    bool monochromaticPattern() const;
+    bool useEdgeFormula() const;
+    bool useSideTable() const;
+    int sideTableSize() const { return sideTableSize_->value(); }
+    void setSideTableStatus(double relativeError, qint64 buildTime /* ms */);
+    bool adaptiveSampling() const;
+    double samplingTolerance() const { return samplingTolerance_->value()/100; }
+    bool showSampleCounts() const;
+    ApertureGeometry::Parameters apertureGeometryParameters() const;
+    // Regenerated only when the shape parameters change; the pointer can be compared to detect that
+    std::shared_ptr<const ApertureGeometry> apertureGeometry() const;
 
 signals:
     void settingChanged();
     void imageSavingRequest();
 
+private:
+    enum LightSource
+    {
+        DaylightSource,
+        BlackbodySource,
+        FileSource,
+    };
+    void onLightSourceChosen(int index);
+    void updateSourceSpectrum();
+
 private:
     Manipulator* exposure_=nullptr;
     Manipulator* screenWidth_=nullptr;
@@ -36,5 +67,20 @@ private:
     Manipulator* curvatureRadius_=nullptr;
     Manipulator* sampleCount_=nullptr;
     Manipulator* wavelengthCount_=nullptr;
+    QComboBox* spectralRule_=nullptr;
+    QComboBox* lightSource_=nullptr;
+    Manipulator* temperature_=nullptr;
+    std::shared_ptr<const SourceSpectrum> fileSpectrum_;
+    std::shared_ptr<const SourceSpectrum> sourceSpectrum_;
+    QCheckBox* useSymmetry_=nullptr;
+    QCheckBox* monochromaticPattern_=nullptr;
+    QCheckBox* useEdgeFormula_=nullptr;
+    QCheckBox* useSideTable_=nullptr;
+    Manipulator* sideTableSize_=nullptr;
+    QLabel* sideTableError_=nullptr;
+    QCheckBox* adaptiveSampling_=nullptr;
+    Manipulator* samplingTolerance_=nullptr;
+    QCheckBox* showSampleCounts_=nullptr;
     QPushButton* saveBtn_=nullptr;
+    mutable std::shared_ptr<const ApertureGeometry> apertureGeometry_;
 };
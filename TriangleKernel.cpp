@@ -0,0 +1,377 @@
+#include "TriangleKernel.hpp"
+#include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef HAVE_SIMD_TRIANGLE_KERNEL
+TriangleKernel::EvaluateFunc triangleKernelEvaluateSSE2;
+TriangleKernel::EvaluateFunc triangleKernelEvaluateEdgesSSE2;
+TriangleKernel::SinCosFunc triangleKernelSinCosSSE2;
+#endif
+#ifdef HAVE_X86_TRIANGLE_KERNELS
+TriangleKernel::EvaluateFunc triangleKernelEvaluateAVX2;
+TriangleKernel::EvaluateFunc triangleKernelEvaluateEdgesAVX2;
+TriangleKernel::SinCosFunc triangleKernelSinCosAVX2;
+TriangleKernel::EvaluateFunc triangleKernelEvaluateAVX512;
+TriangleKernel::EvaluateFunc triangleKernelEvaluateEdgesAVX512;
+TriangleKernel::SinCosFunc triangleKernelSinCosAVX512;
+#endif
+
+namespace
+{
+template<typename T> auto sqr(T x) { return x*x; }
+float sinc(const float x) { return std::abs(x)<1e-4f ? 1 : std::sin(x)/x; }
+
+void evaluateScalar(const TriangleKernel::Triangle*const triangles, const size_t triangleCount,
+                    const float*const kx, const float*const ky, const size_t count,
+                    float*const re, float*const im)
+{
+    const glm::vec2 p0(0,0);
+    for(size_t i=0; i<count; ++i)
+    {
+        const glm::vec2 k(kx[i], ky[i]);
+        float sumRe=0, sumIm=0;
+        for(size_t n=0; n<triangleCount; ++n)
+        {
+            const auto& tri=triangles[n];
+            const auto F=TriangleKernel::triangle(p0, tri.s2, tri.s3, k);
+            sumRe += tri.area*F.x;
+            sumIm += tri.area*F.y;
+        }
+        re[i]=sumRe;
+        im[i]=sumIm;
+    }
+}
+
+// Green's theorem turns the area integral of exp(-ik·r) into a contour integral, giving
+//   F(k) = i/|k|² Σ (k×e) exp(-ik·m) sinc(k·e/2)
+// over the edges e with midpoints m of a counterclockwise outline. To match the triangle fan, whose
+// triangleArea() is minus twice the area for counterclockwise vertices, this is multiplied by -2.
+// exp(-ik·m)*sinc(h), h=k·e/2, is computed from the exponentials at the vertices a and b of the edge:
+// as (E_a-E_b)/(2ih) when |h| is large enough, and as (E_a+E_b)/2*tan(h)/h near the singularity h=0.
+void evaluateEdgesScalar(const TriangleKernel::Triangle*const triangles, const size_t triangleCount,
+                         const float*const kx, const float*const ky, const size_t count,
+                         float*const re, float*const im)
+{
+    const float maxRadius = TriangleKernel::maxVertexDistance(triangles, triangleCount);
+    for(size_t i=0; i<count; ++i)
+    {
+        const glm::vec2 k(kx[i], ky[i]);
+        const float k2 = dot(k,k);
+        if(triangleCount==0 || k2*sqr(maxRadius) < sqr(TriangleKernel::minEdgeFormulaKR))
+        {
+            evaluateScalar(triangles, triangleCount, kx+i, ky+i, 1, re+i, im+i);
+            continue;
+        }
+        float phaseA = dot(k, triangles[0].s2);
+        float sumRe=0, sumIm=0;
+        for(size_t n=0; n<triangleCount; ++n)
+        {
+            const auto& tri=triangles[n];
+            const auto edge = tri.s3 - tri.s2;
+            const float phaseB = dot(k, tri.s3);
+            const float cross = k.x*edge.y - k.y*edge.x;
+            const float h = dot(k, edge)/2;
+            if(std::abs(h) < 0.25f)
+            {
+                const float h2 = h*h;
+                const float coef = cross * (1 + h2*(1.f/3 + h2*(2.f/15 + h2*(17.f/315))));
+                sumRe += coef*(std::cos(phaseA) + std::cos(phaseB));
+                sumIm -= coef*(std::sin(phaseA) + std::sin(phaseB));
+            }
+            else
+            {
+                const float coef = cross/h;
+                sumRe += coef*(std::sin(phaseB) - std::sin(phaseA));
+                sumIm -= coef*(std::cos(phaseA) - std::cos(phaseB));
+            }
+            phaseA = phaseB;
+        }
+        re[i] =  sumIm/k2;
+        im[i] = -sumRe/k2;
+    }
+}
+
+void sincosScalar(const float*const x, const size_t count, float*const sin, float*const cos)
+{
+    for(size_t i=0; i<count; ++i)
+    {
+        sin[i]=std::sin(x[i]);
+        cos[i]=std::cos(x[i]);
+    }
+}
+}
+
+float TriangleKernel::triangleArea(const glm::vec2 p1, const glm::vec2 p2, const glm::vec2 p3)
+{
+    return p1.y*p2.x + p2.y*p3.x + p1.x*p3.y - p1.x*p2.y - p1.y*p3.x - p2.x*p3.y;
+}
+
+float TriangleKernel::maxVertexDistance(const Triangle*const triangles, const size_t triangleCount)
+{
+    float maxDist=0;
+    for(size_t n=0; n<triangleCount; ++n)
+        maxDist = std::max({maxDist, glm::length(triangles[n].s2), glm::length(triangles[n].s3)});
+    return maxDist;
+}
+
+// Ref: Equations (4.1), (4.2), but altering the definition of sinc, in
+//      R.M. Sillitto, W. Sillitto, "A Simple Fourier Approach to Fraunhofer Diffraction by Triangular Apertures"
+//      http://dx.doi.org/10.1080/713819012
+glm::vec2 TriangleKernel::triangle(const glm::vec2 s1, const glm::vec2 s2, const glm::vec2 s3, const glm::vec2 k)
+{
+    using namespace glm;
+
+    if(k==vec2(0)) return vec2(1,0);
+    const vec2 a1=s3-s2;
+    const vec2 b1=s1-s3;
+    const float alpha1=dot(a1,k)/2;
+    const float beta1 =dot(b1,k)/2;
+
+    const vec2 a2=s1-s3;
+    const vec2 b2=s2-s1;
+    const float alpha2=dot(a2,k)/2;
+    const float beta2 =dot(b2,k)/2;
+
+    float alpha, beta;
+    vec2 originShift;
+    // Try to avoid denominator close to zero
+    if(std::abs(alpha1+beta1) > std::abs(alpha2+beta2))
+    {
+        alpha=alpha1;
+        beta =beta1;
+        originShift=s3;
+    }
+    else
+    {
+        alpha=alpha2;
+        beta =beta2;
+        originShift=s1;
+    }
+    const float reY=(alpha*sqr(sinc(alpha))+beta*sqr(sinc(beta)))/(alpha+beta);
+    const float imY=(sinc(2*beta)-sinc(2*alpha))/(alpha+beta);
+    const float reShiftExp =  std::cos(dot(k,originShift));
+    const float imShiftExp = -std::sin(dot(k,originShift));
+    return vec2(reY*reShiftExp-imY*imShiftExp,
+                imY*reShiftExp+reY*imShiftExp);
+}
+
+bool TriangleKernel::isSupported(const ISA isa)
+{
+    switch(isa)
+    {
+    case ISA::Scalar:
+        return true;
+    case ISA::SSE2:
+#ifdef HAVE_SIMD_TRIANGLE_KERNEL
+        return true;
+#else
+        return false;
+#endif
+    case ISA::AVX2:
+#ifdef HAVE_X86_TRIANGLE_KERNELS
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+        return false;
+#endif
+    case ISA::AVX512:
+#ifdef HAVE_X86_TRIANGLE_KERNELS
+        return __builtin_cpu_supports("avx512f");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+TriangleKernel::ISA TriangleKernel::bestSupported()
+{
+    for(const auto isa : {ISA::AVX512, ISA::AVX2, ISA::SSE2})
+        if(isSupported(isa))
+            return isa;
+    return ISA::Scalar;
+}
+
+const char* TriangleKernel::name(const ISA isa)
+{
+    switch(isa)
+    {
+    case ISA::Scalar: return "scalar";
+    case ISA::SSE2:   return "sse2";
+    case ISA::AVX2:   return "avx2";
+    case ISA::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+const char* TriangleKernel::name(const Formula formula)
+{
+    switch(formula)
+    {
+    case Formula::Triangles: return "triangles";
+    case Formula::Edges:     return "edges";
+    }
+    return "unknown";
+}
+
+int TriangleKernel::laneWidth() const
+{
+    switch(isa_)
+    {
+    case ISA::Scalar: return 1;
+    case ISA::SSE2:   return 4;
+    case ISA::AVX2:   return 8;
+    case ISA::AVX512: return 16;
+    }
+    return 1;
+}
+
+void TriangleKernel::select(const ISA isa)
+{
+    isa_=isa;
+    switch(isa)
+    {
+#ifdef HAVE_SIMD_TRIANGLE_KERNEL
+    case ISA::SSE2:
+        evaluateTriangles_=triangleKernelEvaluateSSE2;
+        evaluateEdges_=triangleKernelEvaluateEdgesSSE2;
+        sincos_=triangleKernelSinCosSSE2;
+        break;
+#endif
+#ifdef HAVE_X86_TRIANGLE_KERNELS
+    case ISA::AVX2:
+        evaluateTriangles_=triangleKernelEvaluateAVX2;
+        evaluateEdges_=triangleKernelEvaluateEdgesAVX2;
+        sincos_=triangleKernelSinCosAVX2;
+        break;
+    case ISA::AVX512:
+        evaluateTriangles_=triangleKernelEvaluateAVX512;
+        evaluateEdges_=triangleKernelEvaluateEdgesAVX512;
+        sincos_=triangleKernelSinCosAVX512;
+        break;
+#endif
+    default:
+        isa_=ISA::Scalar;
+        evaluateTriangles_=evaluateScalar;
+        evaluateEdges_=evaluateEdgesScalar;
+        sincos_=sincosScalar;
+        break;
+    }
+    setFormula(formula_);
+}
+
+void TriangleKernel::setFormula(const Formula formula)
+{
+    formula_=formula;
+    evaluate_ = formula==Formula::Edges ? evaluateEdges_ : evaluateTriangles_;
+}
+
+TriangleKernel::TriangleKernel(const ISA isa, const Formula formula)
+    : formula_(formula)
+{
+    select(isSupported(isa) ? isa : ISA::Scalar);
+}
+
+TriangleKernel::TriangleKernel()
+{
+    auto isa=bestSupported();
+    if(const char*const requested=std::getenv("APERDIFF_KERNEL"))
+    {
+        bool found=false;
+        for(const auto candidate : {ISA::Scalar, ISA::SSE2, ISA::AVX2, ISA::AVX512})
+        {
+            if(std::strcmp(requested, name(candidate))!=0) continue;
+            found=true;
+            if(isSupported(candidate))
+                isa=candidate;
+            else
+                std::cerr << "Triangle kernel \"" << requested << "\" isn't supported on this machine, using \""
+                          << name(isa) << "\"\n";
+        }
+        if(!found)
+            std::cerr << "Unknown triangle kernel \"" << requested << "\" requested, using \"" << name(isa) << "\"\n";
+    }
+    select(isa);
+
+    if(isa_!=ISA::Scalar && !checkAccuracy())
+    {
+        std::cerr << "WARNING: triangle kernel \"" << name(isa_) << "\" failed accuracy check, "
+                     "falling back to the scalar one\n";
+        select(ISA::Scalar);
+    }
+}
+
+bool TriangleKernel::checkAccuracy() const
+{
+    // Same input as in GLSLCosineQualityChecker: cosine must strictly decrease on [0°,3°]
+    {
+        constexpr int numPoints=128;
+        constexpr auto degree = M_PI/180;
+        std::vector<float> x, sin(numPoints), cos(numPoints);
+        for(int n = 0; n < numPoints; ++n)
+            x.push_back(3*degree * n/(numPoints-1.));
+        sincos_(x.data(), x.size(), sin.data(), cos.data());
+        for(int n=1; n<numPoints; ++n)
+            if(cos[n] >= cos[n-1])
+                return false;
+    }
+
+    // Compare with the reference on random triangles of aperture size and wave vectors up to
+    // those of violet light at a wide angle, including the special case of k=0
+    for(const auto formula : {Formula::Triangles, Formula::Edges})
+    {
+        std::mt19937 gen(1);
+        std::uniform_real_distribution<float> coord(-1, 1);
+        std::vector<Triangle> triangles;
+        if(formula==Formula::Edges)
+        {
+            // The edge sum needs a closed fan: a random star-shaped polygon
+            constexpr int vertexCount=16;
+            std::vector<glm::vec2> vertices;
+            for(int n=0; n<vertexCount; ++n)
+            {
+                const float angle = 2*M_PI*(n+0.4f*coord(gen))/vertexCount;
+                vertices.push_back((0.75f+0.25f*coord(gen))*glm::vec2(std::cos(angle), std::sin(angle)));
+            }
+            for(int n=0; n<vertexCount; ++n)
+            {
+                const auto s2=vertices[n], s3=vertices[(n+1)%vertexCount];
+                triangles.push_back({s2, s3, triangleArea(glm::vec2(0), s2, s3)});
+            }
+        }
+        else
+        {
+            for(int n=0; n<16; ++n)
+            {
+                const glm::vec2 s2(coord(gen), coord(gen)), s3(coord(gen), coord(gen));
+                triangles.push_back({s2, s3, triangleArea(glm::vec2(0), s2, s3)});
+            }
+        }
+        constexpr int count=1000;
+        std::vector<float> kx(count), ky(count);
+        for(int i=1; i<count; ++i)
+        {
+            const float scale = std::pow(10.f, 4*float(i)/count);
+            kx[i]=scale*coord(gen);
+            ky[i]=scale*coord(gen);
+        }
+        std::vector<float> re(count), im(count), refRe(count), refIm(count);
+        const auto evaluate = formula==Formula::Edges ? evaluateEdges_ : evaluateTriangles_;
+        evaluate(triangles.data(), triangles.size(), kx.data(), ky.data(), count, re.data(), im.data());
+        evaluateScalar(triangles.data(), triangles.size(), kx.data(), ky.data(), count, refRe.data(), refIm.data());
+        float totalArea=0;
+        for(const auto& tri : triangles)
+            totalArea += std::abs(tri.area);
+        for(int i=0; i<count; ++i)
+        {
+            // Summation over triangles loses precision relative to the total area, so compare against that
+            if(!(std::abs(re[i]-refRe[i]) < 1e-4f*totalArea && std::abs(im[i]-refIm[i]) < 1e-4f*totalArea))
+                return false;
+        }
+    }
+    return true;
+}
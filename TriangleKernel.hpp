@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+// Evaluates the Fourier transform of a fan of triangles sharing a vertex at the origin,
+// i.e. the sum of area*triangle(0,s2,s3,k) from glare-shader.frag, for many wave vectors k
+// at once. SIMD implementations are selected at runtime; the scalar one is the reference.
+//
+// When the fan is closed, i.e. it covers a star-shaped polygon, so that s3 of each triangle
+// is s2 of the next one, the same transform can be computed as a sum over the outer edges
+// (Formula::Edges), which needs only one complex exponential per vertex.
+class TriangleKernel
+{
+public:
+    enum class ISA
+    {
+        Scalar,
+        SSE2, // 4-lane path; on non-x86 platforms it's compiled for whatever vector unit there is
+        AVX2,
+        AVX512,
+    };
+    enum class Formula
+    {
+        Triangles, // Sillitto's formula for each triangle, valid for any set of triangles
+        Edges,     // Green's theorem applied to the outline; requires a closed fan
+    };
+    // Below this |k|*maxVertexDistance the edge sum loses too much precision to cancellation,
+    // so the triangle formula is used there instead
+    static constexpr float minEdgeFormulaKR = 1;
+
+    struct Triangle
+    {
+        glm::vec2 s2, s3; // mm
+        float area;
+    };
+    // Signature shared by all the implementations. Writes the real and imaginary parts
+    // of the transform at wave vectors (kx[i],ky[i]), i<count, to re[i],im[i].
+    using EvaluateFunc = void(const Triangle* triangles, size_t triangleCount,
+                              const float* kx, const float* ky, size_t count,
+                              float* re, float* im);
+    // Computes sin and cos of x[i], i<count
+    using SinCosFunc = void(const float* x, size_t count, float* sin, float* cos);
+
+    // Picks the widest supported ISA, unless overridden by APERDIFF_KERNEL environment
+    // variable (one of "scalar", "sse2", "avx2", "avx512"). If the chosen implementation
+    // fails checkAccuracy(), the scalar one is used instead.
+    TriangleKernel();
+    explicit TriangleKernel(ISA isa, Formula formula=Formula::Triangles);
+
+    ISA isa() const { return isa_; }
+    Formula formula() const { return formula_; }
+    void setFormula(Formula formula);
+    int laneWidth() const;
+    void evaluate(const Triangle* triangles, size_t triangleCount,
+                  const float* kx, const float* ky, size_t count,
+                  float* re, float* im) const
+    { evaluate_(triangles, triangleCount, kx, ky, count, re, im); }
+
+    // Compares both formulas against the scalar triangle implementation and checks that cosine is monotonic
+    // near zero, which is what GLSLCosineQualityChecker verifies for the shader.
+    bool checkAccuracy() const;
+
+    static bool isSupported(ISA isa);
+    static ISA bestSupported();
+    static const char* name(ISA isa);
+    static const char* name(Formula formula);
+
+    static glm::vec2 triangle(glm::vec2 s1, glm::vec2 s2, glm::vec2 s3, glm::vec2 k);
+    static float triangleArea(glm::vec2 p1, glm::vec2 p2, glm::vec2 p3);
+    static float maxVertexDistance(const Triangle* triangles, size_t triangleCount);
+
+private:
+    void select(ISA isa);
+
+private:
+    ISA isa_=ISA::Scalar;
+    Formula formula_=Formula::Triangles;
+    EvaluateFunc* evaluate_=nullptr;
+    EvaluateFunc* evaluateTriangles_=nullptr;
+    EvaluateFunc* evaluateEdges_=nullptr;
+    SinCosFunc* sincos_=nullptr;
+};
@@ -0,0 +1,21 @@
+// 8-lane TriangleKernel implementation; this file is built with -mavx2 -mfma
+#include "TriangleKernelSIMD.hpp"
+
+void triangleKernelEvaluateAVX2(const TriangleKernel::Triangle* triangles, size_t triangleCount,
+                               const float* kx, const float* ky, size_t count,
+                               float* re, float* im)
+{
+    SIMD<8>::evaluate<false>(triangles, triangleCount, kx, ky, count, re, im);
+}
+
+void triangleKernelEvaluateEdgesAVX2(const TriangleKernel::Triangle* triangles, size_t triangleCount,
+                                     const float* kx, const float* ky, size_t count,
+                                     float* re, float* im)
+{
+    SIMD<8>::evaluate<true>(triangles, triangleCount, kx, ky, count, re, im);
+}
+
+void triangleKernelSinCosAVX2(const float* x, size_t count, float* sin, float* cos)
+{
+    SIMD<8>::sincos(x, count, sin, cos);
+}
@@ -0,0 +1,21 @@
+// 16-lane TriangleKernel implementation; this file is built with -mavx512f
+#include "TriangleKernelSIMD.hpp"
+
+void triangleKernelEvaluateAVX512(const TriangleKernel::Triangle* triangles, size_t triangleCount,
+                                 const float* kx, const float* ky, size_t count,
+                                 float* re, float* im)
+{
+    SIMD<16>::evaluate<false>(triangles, triangleCount, kx, ky, count, re, im);
+}
+
+void triangleKernelEvaluateEdgesAVX512(const TriangleKernel::Triangle* triangles, size_t triangleCount,
+                                       const float* kx, const float* ky, size_t count,
+                                       float* re, float* im)
+{
+    SIMD<16>::evaluate<true>(triangles, triangleCount, kx, ky, count, re, im);
+}
+
+void triangleKernelSinCosAVX512(const float* x, size_t count, float* sin, float* cos)
+{
+    SIMD<16>::sincos(x, count, sin, cos);
+}
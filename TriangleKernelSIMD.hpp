@@ -0,0 +1,205 @@
+#pragma once
+
+// Generic SIMD implementation of TriangleKernel, written with GCC/Clang vector extensions.
+// It's included by several translation units, each compiled for its own instruction set,
+// so everything here must have internal linkage.
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "TriangleKernel.hpp"
+
+namespace
+{
+
+template<int Lanes>
+struct SIMD
+{
+    typedef float Float __attribute__((vector_size(Lanes*sizeof(float))));
+    typedef std::int32_t Int __attribute__((vector_size(Lanes*sizeof(float))));
+
+    static Float broadcast(const float x) { return Float{} + x; }
+    static Float load(const float* p) { Float v; std::memcpy(&v, p, sizeof v); return v; }
+    static void store(float* p, const Float v) { std::memcpy(p, &v, sizeof v); }
+    static Float select(const Int mask, const Float a, const Float b)
+    {
+        return Float((mask & Int(a)) | (~mask & Int(b)));
+    }
+    static Float abs(const Float x) { return Float(Int(x) & 0x7fffffff); }
+    static Float flipSign(const Float x, const Int mask) { return Float(Int(x) ^ (mask & INT32_MIN)); }
+
+    // Cephes-style sincos: Cody-Waite reduction to [-π/4,π/4], then minimax polynomials.
+    // The error is within a couple of ulps of the true value of the (float) argument,
+    // so cosine is monotonic in the first quadrant, unlike e.g. some GPUs' cos().
+    static void sincos(const Float x, Float& sin, Float& cos)
+    {
+        // Round to nearest by adding and subtracting 1.5*2^23; valid while |x| < 2^22*π/2.
+        // The low mantissa bits of the biased value then hold the quadrant number.
+        constexpr float roundingMagic = 12582912.f;
+        const Float biased = x*0.636619772367581343f + roundingMagic;
+        const Float n = biased - roundingMagic;
+        const Float r = ((x - n*1.5703125f) - n*4.837512969970703125e-4f) - n*7.54978995489188216e-8f;
+        const Int quadrant = Int(biased);
+
+        const Float r2 = r*r;
+        const Float s = r + r*r2*(-1.6666654611e-1f + r2*(8.3321608736e-3f + r2*-1.9515295891e-4f));
+        const Float c = 1.f - 0.5f*r2 + r2*r2*(4.166664568298827e-2f + r2*(-1.388731625493765e-3f + r2*2.443315711809948e-5f));
+
+        const Int swap = (quadrant & 1) != 0;
+        sin = flipSign(select(swap, c, s), (quadrant & 2) != 0);
+        cos = flipSign(select(swap, s, c), ((quadrant+1) & 2) != 0);
+    }
+
+    // sinc(x) and sinc(2x)=sinc(x)*cos(x), with the small-argument cutoff of glare-shader.frag
+    static void sincs(const Float x, Float& sinc, Float& sinc2x)
+    {
+        Float sin, cos;
+        sincos(x, sin, cos);
+        const Int small = abs(x) < 1e-4f;
+        const Float safeX = select(small, broadcast(1), x);
+        sinc = select(small, broadcast(1), sin/safeX);
+        sinc2x = select(small, broadcast(1), sin*cos/safeX);
+    }
+
+    // See TriangleKernel::triangle() for the reference. With s1 at the origin the choice of
+    // the better-conditioned denominator reduces to comparing |k·s2| with |k·(s2-s3)|.
+    static void evaluateBatch(const TriangleKernel::Triangle*const triangles, const size_t triangleCount,
+                              const Float kx, const Float ky, Float& outRe, Float& outIm)
+    {
+        const Int kIsZero = (kx == 0.f) & (ky == 0.f);
+        Float sumRe = broadcast(0), sumIm = broadcast(0);
+        for(size_t n=0; n<triangleCount; ++n)
+        {
+            const auto& tri = triangles[n];
+            const Float u = kx*tri.s2.x + ky*tri.s2.y;
+            const Float v = kx*tri.s3.x + ky*tri.s3.y;
+            const Int firstVariant = abs(u) > abs(u-v);
+            const Float alpha = select(firstVariant, 0.5f*(v-u), -0.5f*v);
+            const Float beta  = select(firstVariant, -0.5f*v, 0.5f*u);
+            const Float phase = select(firstVariant, v, broadcast(0));
+            const Float denom = select(kIsZero, broadcast(1), alpha+beta);
+
+            Float sincA, sinc2A, sincB, sinc2B, sinPhase, cosPhase;
+            sincs(alpha, sincA, sinc2A);
+            sincs(beta, sincB, sinc2B);
+            sincos(phase, sinPhase, cosPhase);
+
+            const Float reY = (alpha*sincA*sincA + beta*sincB*sincB)/denom;
+            const Float imY = (sinc2B - sinc2A)/denom;
+            const Float re = select(kIsZero, broadcast(1), reY*cosPhase + imY*sinPhase);
+            const Float im = select(kIsZero, broadcast(0), imY*cosPhase - reY*sinPhase);
+            sumRe += tri.area*re;
+            sumIm += tri.area*im;
+        }
+        outRe = sumRe;
+        outIm = sumIm;
+    }
+
+    // See evaluateEdgesScalar() in TriangleKernel.cpp for the reference. Lanes with k close to
+    // zero, where the edge sum cancels catastrophically, take the triangle formula instead.
+    static void evaluateEdgesBatch(const TriangleKernel::Triangle*const triangles, const size_t triangleCount,
+                                   const float maxRadius, const Float kx, const Float ky, Float& outRe, Float& outIm)
+    {
+        const Float k2 = kx*kx + ky*ky;
+        const Int smallK = k2*(maxRadius*maxRadius) < TriangleKernel::minEdgeFormulaKR*TriangleKernel::minEdgeFormulaKR;
+        Float triRe = broadcast(0), triIm = broadcast(0);
+        std::int32_t smallLanes[Lanes];
+        std::memcpy(smallLanes, &smallK, sizeof smallLanes);
+        if(std::any_of(smallLanes, smallLanes+Lanes, [](std::int32_t lane){ return lane!=0; }))
+            evaluateBatch(triangles, triangleCount, kx, ky, triRe, triIm);
+        if(triangleCount==0)
+        {
+            outRe = triRe;
+            outIm = triIm;
+            return;
+        }
+
+        // exp(-ik·s) at the start of the current edge, which is the end of the previous one
+        Float sinA, cosA;
+        sincos(kx*triangles[0].s2.x + ky*triangles[0].s2.y, sinA, cosA);
+        Float sumRe = broadcast(0), sumIm = broadcast(0);
+        for(size_t n=0; n<triangleCount; ++n)
+        {
+            const auto& tri = triangles[n];
+            const glm::vec2 edge = tri.s3 - tri.s2;
+            Float sinB, cosB;
+            sincos(kx*tri.s3.x + ky*tri.s3.y, sinB, cosB);
+            const Float cross = kx*edge.y - ky*edge.x;
+            const Float h = 0.5f*(kx*edge.x + ky*edge.y);
+            const Float h2 = h*h;
+            const Int smallH = abs(h) < 0.25f;
+            // The factors of 1/2 cancel with the 2 in the triangle fan's normalization.
+            // Near k·edge=0: exp(-ik·midpoint)*sinc(h) = (E_a+E_b)/2 * tan(h)/h, with tan(h)/h as a series
+            const Float tanhOverH = 1.f + h2*(1.f/3 + h2*(2.f/15 + h2*(17.f/315)));
+            const Float nearCoef = cross*tanhOverH;
+            // Elsewhere: (E_a-E_b)/(2ih)
+            const Float farCoef = cross/select(smallH, broadcast(1), h);
+            const Float sumE_re = cosA + cosB, sumE_im = -(sinA + sinB);
+            const Float diffE_re = cosA - cosB, diffE_im = sinB - sinA;
+            sumRe += select(smallH, nearCoef*sumE_re, farCoef*diffE_im);
+            sumIm += select(smallH, nearCoef*sumE_im, -farCoef*diffE_re);
+            sinA = sinB;
+            cosA = cosB;
+        }
+        // Multiply by -i/|k|²
+        const Float safeK2 = select(smallK, broadcast(1), k2);
+        outRe = select(smallK, triRe, sumIm/safeK2);
+        outIm = select(smallK, triIm, -sumRe/safeK2);
+    }
+
+    template<bool Edges>
+    static void evaluateBatchFor(const TriangleKernel::Triangle*const triangles, const size_t triangleCount,
+                                 const float maxRadius, const Float kx, const Float ky, Float& outRe, Float& outIm)
+    {
+        if(Edges)
+            evaluateEdgesBatch(triangles, triangleCount, maxRadius, kx, ky, outRe, outIm);
+        else
+            evaluateBatch(triangles, triangleCount, kx, ky, outRe, outIm);
+    }
+
+    template<bool Edges>
+    static void evaluate(const TriangleKernel::Triangle*const triangles, const size_t triangleCount,
+                         const float*const kx, const float*const ky, const size_t count,
+                         float*const re, float*const im)
+    {
+        const float maxRadius = Edges ? TriangleKernel::maxVertexDistance(triangles, triangleCount) : 0;
+        size_t i=0;
+        for(; i+Lanes<=count; i+=Lanes)
+        {
+            Float batchRe, batchIm;
+            evaluateBatchFor<Edges>(triangles, triangleCount, maxRadius, load(kx+i), load(ky+i), batchRe, batchIm);
+            store(re+i, batchRe);
+            store(im+i, batchIm);
+        }
+        if(i==count) return;
+
+        // Pad the tail to the full lane width
+        float tailKx[Lanes]={}, tailKy[Lanes]={}, tailRe[Lanes], tailIm[Lanes];
+        std::copy(kx+i, kx+count, tailKx);
+        std::copy(ky+i, ky+count, tailKy);
+        Float batchRe, batchIm;
+        evaluateBatchFor<Edges>(triangles, triangleCount, maxRadius, load(tailKx), load(tailKy), batchRe, batchIm);
+        store(tailRe, batchRe);
+        store(tailIm, batchIm);
+        std::copy(tailRe, tailRe+(count-i), re+i);
+        std::copy(tailIm, tailIm+(count-i), im+i);
+    }
+
+    static void sincos(const float*const x, const size_t count, float*const sin, float*const cos)
+    {
+        for(size_t i=0; i<count; i+=Lanes)
+        {
+            float in[Lanes]={}, outSin[Lanes], outCos[Lanes];
+            const auto num = std::min<size_t>(Lanes, count-i);
+            std::copy(x+i, x+i+num, in);
+            Float s, c;
+            sincos(load(in), s, c);
+            store(outSin, s);
+            store(outCos, c);
+            std::copy(outSin, outSin+num, sin+i);
+            std::copy(outCos, outCos+num, cos+i);
+        }
+    }
+};
+
+}
@@ -0,0 +1,21 @@
+// 4-lane TriangleKernel implementation, built with the baseline instruction set (SSE2 on x86-64)
+#include "TriangleKernelSIMD.hpp"
+
+void triangleKernelEvaluateSSE2(const TriangleKernel::Triangle* triangles, size_t triangleCount,
+                               const float* kx, const float* ky, size_t count,
+                               float* re, float* im)
+{
+    SIMD<4>::evaluate<false>(triangles, triangleCount, kx, ky, count, re, im);
+}
+
+void triangleKernelEvaluateEdgesSSE2(const TriangleKernel::Triangle* triangles, size_t triangleCount,
+                                     const float* kx, const float* ky, size_t count,
+                                     float* re, float* im)
+{
+    SIMD<4>::evaluate<true>(triangles, triangleCount, kx, ky, count, re, im);
+}
+
+void triangleKernelSinCosSSE2(const float* x, size_t count, float* sin, float* cos)
+{
+    SIMD<4>::sincos(x, count, sin, cos);
+}
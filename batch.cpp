@@ -0,0 +1,191 @@
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <QMutex>
+#include <QThreadPool>
+#include <QMutexLocker>
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include "BatchJob.hpp"
+#include "TiledCPURenderer.hpp"
+#include "BigTiffWriter.hpp"
+#include "common.hpp"
+
+namespace
+{
+// Renders the job tile by tile straight to the output file, so that the whole image never has to
+// be in memory. The tiles already in the file from an interrupted run of the same job are kept.
+// Returns an empty string on success, the error otherwise.
+QString renderTiled(BatchJob const& job, CPUGlareRenderer::Parameters const& params,
+                    int& tileCount, int& resumedTileCount)
+{
+    // A file written with other parameters won't match and is started over
+    const auto jobHash = QCryptographicHash::hash(job.renderKey(), QCryptographicHash::Sha1).toHex();
+    BigTiffWriter writer(job.output, job.width, job.height, job.tileSize,
+                         "aperdiff linear sRGB, job " + QString::fromLatin1(jobHash));
+    if(const auto error = writer.open(); !error.isEmpty())
+        return error;
+    tileCount = writer.tileCount();
+    resumedTileCount = writer.writtenTileCount();
+
+    CPUGlareRenderer engine;
+    engine.setParameters(params);
+    engine.setImageSize(job.width, job.height);
+    const int size = job.tileSize;
+    std::vector<glm::vec4> luminance(size_t(size)*size);
+    std::vector<float> rgb(size_t(size)*size*3);
+    for(int index=0; index<tileCount; ++index)
+    {
+        if(writer.tileWritten(index))
+            continue;
+        // The file's tiles go from the top, the renderer's rows from the bottom
+        const int x = index % writer.tilesAcross() * size;
+        const int top = index / writer.tilesAcross() * size;
+        const int width = std::min(size, job.width-x);
+        const int height = std::min(size, job.height-top);
+        const int y = job.height-top-height;
+
+        auto tiles = CPUGlareRenderer::tiles(width, height, TiledCPURenderer::tileSize);
+        QtConcurrent::blockingMap(tiles, [&](CPUGlareRenderer::Tile const& tile)
+        {
+            engine.renderTile({x+tile.x, y+tile.y, tile.width, tile.height},
+                              luminance.data()+size_t(tile.y)*size+tile.x, size);
+        });
+
+        // Not normalized, since the maximum of the whole image is unknown until the end
+        std::fill(rgb.begin(), rgb.end(), 0.f);
+        for(int row=0; row<height; ++row)
+        {
+            for(int col=0; col<width; ++col)
+            {
+                const auto color = XYZToLinearSRGB(glm::vec3(luminance[size_t(height-1-row)*size+col]));
+                std::copy(&color[0], &color[0]+3, rgb.begin()+(size_t(row)*size+col)*3);
+            }
+        }
+        if(const auto error = writer.writeTile(index, rgb.data()); !error.isEmpty())
+            return error;
+    }
+    return {};
+}
+}
+
+// Renders a list of jobs without a window, using the CPU renderer. Each job's tiles go to the
+// global thread pool, while several jobs are in flight at once, so that the tail of one job,
+// when only a few tiles remain, and the writing of its image overlap the next job's tiles.
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("aperdiff-batch");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders diffraction patterns listed in a job file to float TIFF images.\n\n"
+                                     "Keys of a job:\n"+BatchJob::keyDescriptions());
+    parser.addHelpOption();
+    parser.addPositionalArgument("jobfile", "JSON or INI file with the list of jobs");
+    const QCommandLineOption parallelOption({"j", "parallel"}, "Number of jobs in flight at once", "count", "2");
+    parser.addOption(parallelOption);
+    parser.process(app);
+
+    if(parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+    bool ok=false;
+    const int parallelJobs = parser.value(parallelOption).toInt(&ok);
+    if(!ok || parallelJobs<1)
+    {
+        std::cerr << "Bad number of jobs in flight: " << parser.value(parallelOption).toStdString() << "\n";
+        return 1;
+    }
+
+    const auto jobFile = parser.positionalArguments()[0];
+    QString error;
+    const auto jobs = BatchJob::load(jobFile, error);
+    if(jobs.empty())
+    {
+        std::cerr << "Failed to load jobs from " << jobFile.toStdString() << ": " << error.toStdString() << "\n";
+        return 1;
+    }
+
+    // The quadrature caches its tables and isn't thread-safe, so all parameters are prepared up front
+    SpectralQuadrature quadrature;
+    std::vector<CPUGlareRenderer::Parameters> params;
+    for(const auto& job : jobs)
+        params.push_back(job.parameters(quadrature));
+
+    QMutex outputMutex;
+    std::atomic<int> failureCount{0};
+    const auto runJob = [&](const int index)
+    {
+        const auto& job = jobs[index];
+        QElapsedTimer timer;
+        timer.start();
+
+        if(job.tileSize)
+        {
+            int tileCount=0, resumedTileCount=0;
+            const auto error = renderTiled(job, params[index], tileCount, resumedTileCount);
+            const double seconds = timer.nsecsElapsed()*1e-9;
+
+            QMutexLocker lock(&outputMutex);
+            if(!error.isEmpty())
+            {
+                ++failureCount;
+                std::cerr << job.name.toStdString() << ": failed to write tiles to " << job.output.toStdString()
+                          << ": " << error.toStdString() << "\n";
+                return;
+            }
+            const double renderedFraction = tileCount ? double(tileCount-resumedTileCount)/tileCount : 0;
+            const double megapixels = job.width*job.height*1e-6 * renderedFraction;
+            std::cout << job.name.toStdString() << ": " << job.width << "x" << job.height << " px in "
+                      << tileCount << " tiles (" << resumedTileCount << " resumed), "
+                      << params[index].wavelengths.size() << " wavelengths, rendered and written in " << seconds
+                      << " s (" << megapixels * params[index].wavelengths.size() / seconds
+                      << " Mpixel*wavelength/s) to " << job.output.toStdString() << std::endl;
+            return;
+        }
+
+        CPUGlareRenderer engine;
+        engine.setParameters(params[index]);
+        engine.setImageSize(job.width, job.height);
+        std::vector<glm::vec4> luminance(size_t(job.width)*job.height);
+        auto tiles = CPUGlareRenderer::tiles(job.width, job.height, TiledCPURenderer::tileSize);
+        // Tiles don't overlap, so no locking is needed
+        QtConcurrent::blockingMap(tiles, [&](CPUGlareRenderer::Tile const& tile)
+                                  { engine.renderTile(tile, luminance.data()+size_t(tile.y)*job.width+tile.x, job.width); });
+        const double renderSeconds = timer.nsecsElapsed()*1e-9;
+
+        const auto error = saveLuminanceImage(job.output, std::move(luminance), job.width, job.height, job.normalize);
+        const double totalSeconds = timer.nsecsElapsed()*1e-9;
+
+        QMutexLocker lock(&outputMutex);
+        if(!error.isEmpty())
+        {
+            ++failureCount;
+            std::cerr << job.name.toStdString() << ": failed to save image to " << job.output.toStdString()
+                      << ": " << error.toStdString() << "\n";
+            return;
+        }
+        const double megapixels = job.width*job.height*1e-6;
+        std::cout << job.name.toStdString() << ": " << job.width << "x" << job.height << " px, "
+                  << params[index].wavelengths.size() << " wavelengths, rendered in " << renderSeconds << " s ("
+                  << megapixels * params[index].wavelengths.size() / renderSeconds << " Mpixel*wavelength/s), "
+                  << "saved in " << totalSeconds-renderSeconds << " s to " << job.output.toStdString() << std::endl;
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    QThreadPool jobPool;
+    jobPool.setMaxThreadCount(parallelJobs);
+    std::vector<QFuture<void>> futures;
+    for(int n=0; n<int(jobs.size()); ++n)
+        futures.push_back(QtConcurrent::run(&jobPool, runJob, n));
+    for(auto& future : futures)
+        future.waitForFinished();
+
+    std::cout << jobs.size()-failureCount << " of " << jobs.size() << " jobs done in "
+              << timer.nsecsElapsed()*1e-9 << " s on " << QThreadPool::globalInstance()->maxThreadCount()
+              << " threads" << std::endl;
+    return failureCount ? 1 : 0;
+}
@@ -0,0 +1,450 @@
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <QFile>
+#include <QSysInfo>
+#include <QVector2D>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QApplication>
+#include <QJsonDocument>
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QCommandLineParser>
+#include <QRegularExpression>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLFunctions_3_3_Core>
+#include "GLSLCosineQualityChecker.hpp"
+#include "SpectralQuadrature.hpp"
+#include "CPUGlareRenderer.hpp"
+#include "TiledCPURenderer.hpp"
+#include "common.hpp"
+
+namespace
+{
+// The scenarios are fixed, so that results of different builds, drivers and machines compare
+struct Shape
+{
+    int pointCount, arcPointCount;
+};
+const Shape kernelShape{6,25};
+const Shape glarePassShapes[]={{5,0}, {6,25}, {9,25}, {6,100}};
+constexpr int glarePassSize=512; // px
+constexpr int glarePassWavelengthCount=16;
+// The default settings of the UI
+const Shape renderShape{6,25};
+const int renderSizes[]={256, 512, 1024}; // px
+constexpr int renderWavelengthCount=256;
+
+float wavelengthToWavenumber(const float wavelength)
+{
+    return 2e6*M_PI / wavelength;
+}
+
+std::shared_ptr<const ApertureGeometry> makeGeometry(Shape const& shape)
+{
+    return std::make_shared<const ApertureGeometry>(
+                ApertureGeometry::Parameters{shape.pointCount, shape.arcPointCount, 3, 0});
+}
+
+QString shapeName(Shape const& shape)
+{
+    return QString("%1x%2").arg(shape.pointCount).arg(shape.arcPointCount);
+}
+
+struct Timing
+{
+    double median, best; // s
+    int runs;
+};
+
+// Repeats the run, which returns its time in seconds, at least 3 times and for at least minTime seconds
+template<typename Run>
+Timing measure(Run&& run, const double minTime)
+{
+    std::vector<double> times;
+    QElapsedTimer timer;
+    timer.start();
+    do times.push_back(run());
+    while(times.size() < 3 || timer.nsecsElapsed()*1e-9 < minTime);
+    std::sort(times.begin(), times.end());
+    return {times[times.size()/2], times.front(), int(times.size())};
+}
+
+class Bench
+{
+public:
+    Bench(QRegularExpression const& filter, const double minTime)
+        : filter_(filter)
+        , minTime_(minTime)
+    {
+    }
+
+    void benchKernels();
+    void benchGlarePasses();
+    void benchRenders();
+    QJsonObject report() const;
+
+private:
+    bool selected(QString const& name) const { return filter_.match(name).hasMatch(); }
+    void addResult(QString const& name, Timing const& timing, QJsonObject result);
+    std::vector<CPUGlareRenderer::Wavelength> wavelengths(int count);
+
+private:
+    QRegularExpression filter_;
+    double minTime_;
+    QJsonArray results_;
+    QJsonObject glInfo_;
+    SpectralQuadrature quadrature_;
+};
+
+void Bench::addResult(QString const& name, Timing const& timing, QJsonObject result)
+{
+    result["name"] = name;
+    result["medianSeconds"] = timing.median;
+    result["bestSeconds"] = timing.best;
+    result["runs"] = timing.runs;
+    results_.append(result);
+    std::cerr << name.toStdString() << ": " << timing.median*1e3 << " ms";
+    for(const auto key : {"trianglesPerSecond", "megapixelWavelengthsPerSecond"})
+        if(result.contains(key))
+            std::cerr << ", " << key << "=" << result[key].toDouble();
+    std::cerr << std::endl;
+}
+
+std::vector<CPUGlareRenderer::Wavelength> Bench::wavelengths(const int count)
+{
+    std::vector<CPUGlareRenderer::Wavelength> wavelengths;
+    for(const auto& node : quadrature_.nodes(SourceSpectrum::d65(), SpectralQuadrature::Rule::Trapezoid, count))
+        wavelengths.push_back(CPUGlareRenderer::wavelength(node, 1));
+    return wavelengths;
+}
+
+// Evaluates the transform of the aperture at a row of wave vectors, as CPUGlareRenderer does for a row of a tile
+void Bench::benchKernels()
+{
+    const auto geometry = makeGeometry(kernelShape);
+    std::vector<TriangleKernel::Triangle> triangles;
+    for(int n=0; n<geometry->triangleCount(); ++n)
+    {
+        const auto v1 = geometry->triangleVertex1(n), v2 = geometry->triangleVertex2(n);
+        triangles.push_back({v1, v2, TriangleKernel::triangleArea(glm::vec2(0), v1, v2)});
+    }
+    // A diagonal of the image at 555 nm with the default screen width, 1 m at 10 m away
+    constexpr size_t count=4096;
+    std::vector<float> kx(count), ky(count), re(count), im(count);
+    for(size_t i=0; i<count; ++i)
+    {
+        const float p = (i+0.5f)/count * 500; // mm
+        kx[i] = ky[i] = wavelengthToWavenumber(555) * p / std::hypot(std::sqrt(2.f)*p, 10e3f);
+    }
+
+    for(const auto isa : {TriangleKernel::ISA::Scalar, TriangleKernel::ISA::SSE2,
+                          TriangleKernel::ISA::AVX2, TriangleKernel::ISA::AVX512})
+    {
+        if(!TriangleKernel::isSupported(isa))
+            continue;
+        for(const auto formula : {TriangleKernel::Formula::Triangles, TriangleKernel::Formula::Edges})
+        {
+            const auto name = QString("kernel/%1/%2/%3").arg(QString(TriangleKernel::name(isa)), QString(TriangleKernel::name(formula)),
+                                                             shapeName(kernelShape));
+            if(!selected(name))
+                continue;
+            const TriangleKernel kernel(isa, formula);
+            const auto timing = measure([&]
+            {
+                QElapsedTimer timer;
+                timer.start();
+                kernel.evaluate(triangles.data(), triangles.size(), kx.data(), ky.data(), count, re.data(), im.data());
+                return timer.nsecsElapsed()*1e-9;
+            }, minTime_);
+            addResult(name, timing, {{"triangles", int(triangles.size())},
+                                     {"waveVectors", int(count)},
+                                     {"trianglesPerSecond", triangles.size()*count/timing.median}});
+        }
+    }
+}
+
+// Runs the glare shader over the whole image for all wavelengths, as one iteration of
+// Canvas::renderGlare() does when its scissor rect has grown to the whole image
+void Bench::benchGlarePasses()
+{
+    std::vector<QString> names;
+    for(const auto& shape : glarePassShapes)
+        for(const auto formula : {TriangleKernel::Formula::Triangles, TriangleKernel::Formula::Edges})
+            names.push_back(QString("glare-pass/%1/%2/%3x%3/%4wl").arg(shapeName(shape), QString(TriangleKernel::name(formula)))
+                                                                  .arg(glarePassSize).arg(glarePassWavelengthCount));
+    if(std::none_of(names.begin(), names.end(), [this](QString const& name){ return selected(name); }))
+        return;
+
+    QOffscreenSurface surface;
+    surface.setFormat(makeGLSurfaceFormat());
+    surface.create();
+    QOpenGLContext context;
+    context.setFormat(makeGLSurfaceFormat());
+    QOpenGLFunctions_3_3_Core functions;
+    const auto gl = &functions;
+    if(!context.create() || !context.makeCurrent(&surface) || !gl->initializeOpenGLFunctions())
+    {
+        glInfo_["error"] = QString("failed to create an OpenGL %1.%2 context").arg(OPENGL_MAJOR_VERSION)
+                                                                            .arg(OPENGL_MINOR_VERSION);
+        std::cerr << "Skipping glare passes: " << glInfo_["error"].toString().toStdString() << "\n";
+        return;
+    }
+    glInfo_["renderer"] = reinterpret_cast<const char*>(gl->glGetString(GL_RENDERER));
+    glInfo_["version"] = reinterpret_cast<const char*>(gl->glGetString(GL_VERSION));
+
+    // The same program as Canvas builds
+    QByteArray fragSrc =
+#include "glare-shader.frag"
+        ;
+    fragSrc.replace("COSINE_IS_BROKEN", GLSLCosineQualityChecker(*gl).isGood() ? "0" : "1");
+    fragSrc.replace("WAVELENGTH_BATCH_SIZE", QByteArray::number(wavelengthBatchSize));
+    const char*const vertSrc =
+#include "glare-shader.vert"
+        ;
+    QOpenGLShaderProgram program;
+    if(!program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertSrc) ||
+       !program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragSrc) || !program.link())
+    {
+        glInfo_["error"] = "failed to build the glare shader program: " + program.log();
+        std::cerr << "Skipping glare passes: " << glInfo_["error"].toString().toStdString() << "\n";
+        return;
+    }
+
+    GLuint vao=0, vbo=0;
+    gl->glGenVertexArrays(1, &vao);
+    gl->glBindVertexArray(vao);
+    gl->glGenBuffers(1, &vbo);
+    gl->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    const GLfloat vertices[]={-1,-1, 1,-1, -1,1, 1,1};
+    gl->glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices, GL_STATIC_DRAW);
+    gl->glVertexAttribPointer(0, 2, GL_FLOAT, false, 0, 0);
+    gl->glEnableVertexAttribArray(0);
+
+    constexpr int size=glarePassSize;
+    GLuint textures[2]={}, fbo=0, depthBuffer=0;
+    gl->glGenTextures(2, textures);
+    gl->glGenFramebuffers(1, &fbo);
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    for(int n=0; n<2; ++n)
+    {
+        gl->glBindTexture(GL_TEXTURE_2D, textures[n]);
+        gl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+        gl->glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0+n, textures[n], 0);
+    }
+    const GLenum drawBuffers[]={GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    gl->glDrawBuffers(2, drawBuffers);
+    gl->glGenRenderbuffers(1, &depthBuffer);
+    gl->glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    gl->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, size, size);
+    gl->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    gl->glViewport(0, 0, size, size);
+
+    // Two texels per wavelength, as in Canvas::setupSpectrum()
+    std::vector<glm::vec4> spectrum;
+    for(const auto& wl : wavelengths(glarePassWavelengthCount))
+    {
+        spectrum.push_back(wl.radianceToLuminance);
+        spectrum.emplace_back(wl.wavenumber, 0, 0, 0);
+    }
+    GLuint buffers[2]={}, bufferTextures[2]={};
+    gl->glGenBuffers(2, buffers);
+    gl->glGenTextures(2, bufferTextures);
+    const auto uploadBuffer = [&](const int n, std::vector<glm::vec4> const& data)
+    {
+        gl->glBindBuffer(GL_TEXTURE_BUFFER, buffers[n]);
+        gl->glBufferData(GL_TEXTURE_BUFFER, data.size() * sizeof data[0], data.data(), GL_STATIC_DRAW);
+        gl->glBindTexture(GL_TEXTURE_BUFFER, bufferTextures[n]);
+        gl->glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[n]);
+    };
+    uploadBuffer(1, spectrum);
+
+    program.bind();
+    program.setUniformValue("imageSize", QVector2D(size, size));
+    program.setUniformValue("targetWidth", 1000.f);
+    program.setUniformValue("coordinates", 0);
+    program.setUniformValue("zoom", 1.f);
+    program.setUniformValue("viewOrigin", QVector2D(-size/2, -size/2));
+    program.setUniformValue("sideTable", 0);
+    program.setUniformValue("wavelengthCount", glarePassWavelengthCount);
+    program.setUniformValue("sampleShift", QVector2D(0.5, 0.5));
+    program.setUniformValue("secondHalf", 0.f);
+    program.setUniformValue("apertureTriangles", 0);
+    program.setUniformValue("sideTransform", 1);
+    program.setUniformValue("spectrum", 2);
+    gl->glActiveTexture(GL_TEXTURE2);
+    gl->glBindTexture(GL_TEXTURE_BUFFER, bufferTextures[1]);
+    gl->glActiveTexture(GL_TEXTURE0);
+    gl->glEnable(GL_DEPTH_TEST);
+    gl->glEnable(GL_BLEND);
+    gl->glBlendFunc(GL_ONE, GL_ONE);
+
+    GLuint query=0;
+    gl->glGenQueries(1, &query);
+    const int batchCount = (glarePassWavelengthCount+wavelengthBatchSize-1)/wavelengthBatchSize;
+    const auto runPass = [&]
+    {
+        gl->glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+        gl->glBeginQuery(GL_TIME_ELAPSED, query);
+        gl->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batchCount);
+        gl->glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 elapsed=0; // ns
+        gl->glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        return elapsed*1e-9;
+    };
+
+    auto name = names.begin();
+    for(const auto& shape : glarePassShapes)
+    {
+        const auto geometry = makeGeometry(shape);
+        std::vector<glm::vec4> triangles;
+        float maxRadius=0;
+        for(int n=0; n<geometry->triangleCount(); ++n)
+        {
+            const auto v1 = geometry->triangleVertex1(n), v2 = geometry->triangleVertex2(n);
+            triangles.emplace_back(v1.x, v1.y, v2.x, v2.y);
+            maxRadius = std::max(maxRadius, glm::length(v1));
+        }
+        uploadBuffer(0, triangles);
+        program.setUniformValue("triangleCount", int(triangles.size()));
+        program.setUniformValue("apertureMaxRadius", maxRadius);
+
+        for(const auto formula : {TriangleKernel::Formula::Triangles, TriangleKernel::Formula::Edges})
+        {
+            if(!selected(*name++))
+                continue;
+            program.setUniformValue("edgeFormula", int(formula==TriangleKernel::Formula::Edges));
+            // The first draw may include compilation of the shader for the current state
+            runPass();
+            const auto timing = measure(runPass, minTime_);
+            const double pixelWavelengths = double(size)*size*glarePassWavelengthCount;
+            addResult(name[-1], timing, {{"triangles", int(triangles.size())},
+                                         {"width", size}, {"height", size},
+                                         {"wavelengths", glarePassWavelengthCount},
+                                         {"trianglesPerSecond", pixelWavelengths*triangles.size()/timing.median},
+                                         {"megapixelWavelengthsPerSecond", pixelWavelengths*1e-6/timing.median}});
+        }
+    }
+
+    gl->glDeleteQueries(1, &query);
+    gl->glDeleteTextures(2, bufferTextures);
+    gl->glDeleteBuffers(2, buffers);
+    gl->glDeleteRenderbuffers(1, &depthBuffer);
+    gl->glDeleteFramebuffers(1, &fbo);
+    gl->glDeleteTextures(2, textures);
+    gl->glDeleteBuffers(1, &vbo);
+    gl->glDeleteVertexArrays(1, &vao);
+    context.doneCurrent();
+}
+
+// Renders whole images on the CPU with the default settings, the way aperdiff-batch does
+void Bench::benchRenders()
+{
+    for(const int size : renderSizes)
+    {
+        const auto name = QString("render-cpu/%1/edges/%2x%2/%3wl").arg(shapeName(renderShape)).arg(size)
+                                                                   .arg(renderWavelengthCount);
+        if(!selected(name))
+            continue;
+        CPUGlareRenderer::Parameters params;
+        params.geometry = makeGeometry(renderShape);
+        params.formula = TriangleKernel::Formula::Edges;
+        params.wavelengths = wavelengths(renderWavelengthCount);
+        CPUGlareRenderer engine;
+        engine.setParameters(params);
+        engine.setImageSize(size, size);
+        std::vector<glm::vec4> luminance(size_t(size)*size);
+        const auto timing = measure([&]
+        {
+            QElapsedTimer timer;
+            timer.start();
+            auto tiles = CPUGlareRenderer::tiles(size, size, TiledCPURenderer::tileSize);
+            QtConcurrent::blockingMap(tiles, [&](CPUGlareRenderer::Tile const& tile)
+                                      { engine.renderTile(tile, luminance.data()+size_t(tile.y)*size+tile.x, size); });
+            return timer.nsecsElapsed()*1e-9;
+        }, minTime_);
+        const double pixelWavelengths = double(size)*size*renderWavelengthCount;
+        addResult(name, timing, {{"triangles", params.geometry->triangleCount()},
+                                 {"width", size}, {"height", size},
+                                 {"wavelengths", renderWavelengthCount},
+                                 {"isa", TriangleKernel::name(engine.kernel().isa())},
+                                 {"trianglesPerSecond", pixelWavelengths*params.geometry->triangleCount()/timing.median},
+                                 {"megapixelWavelengthsPerSecond", pixelWavelengths*1e-6/timing.median}});
+    }
+}
+
+QJsonObject Bench::report() const
+{
+    return {
+        {"formatVersion", 1},
+        {"time", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)},
+        {"system", QSysInfo::prettyProductName()},
+        {"cpuArchitecture", QSysInfo::currentCpuArchitecture()},
+        {"threads", QThreadPool::globalInstance()->maxThreadCount()},
+        {"bestKernel", TriangleKernel::name(TriangleKernel::bestSupported())},
+        {"qtVersion", qVersion()},
+        {"gl", glInfo_},
+        {"results", results_},
+    };
+}
+}
+
+// Times the triangle kernels, single passes of the glare shader and whole renders in fixed
+// scenarios, and writes the results as JSON for tracking performance across builds
+int main(int argc, char** argv)
+{
+    QApplication app(argc, argv);
+    app.setApplicationName("aperdiff-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the throughput of the renderers in fixed scenarios. The results go "
+                                     "to the standard output as JSON, the progress to the standard error.");
+    parser.addHelpOption();
+    const QCommandLineOption filterOption({"f", "filter"}, "Run only the scenarios whose names match the regular "
+                                          "expression, e.g. ^kernel/", "regex", ".");
+    const QCommandLineOption minTimeOption({"t", "min-time"}, "Repeat each scenario for at least this time, "
+                                           "and at least 3 times", "seconds", "1");
+    const QCommandLineOption outputOption({"o", "output"}, "Write the results to the file instead", "path");
+    parser.addOptions({filterOption, minTimeOption, outputOption});
+    parser.process(app);
+
+    const QRegularExpression filter(parser.value(filterOption));
+    if(!filter.isValid())
+    {
+        std::cerr << "Bad filter: " << filter.errorString().toStdString() << "\n";
+        return 1;
+    }
+    bool ok=false;
+    const double minTime = parser.value(minTimeOption).toDouble(&ok);
+    if(!ok || !(minTime >= 0))
+    {
+        std::cerr << "Bad minimum time: " << parser.value(minTimeOption).toStdString() << "\n";
+        return 1;
+    }
+
+    Bench bench(filter, minTime);
+    bench.benchKernels();
+    bench.benchGlarePasses();
+    bench.benchRenders();
+    const auto json = QJsonDocument(bench.report()).toJson();
+
+    if(!parser.isSet(outputOption))
+    {
+        std::cout << json.toStdString();
+        return 0;
+    }
+    QFile file(parser.value(outputOption));
+    if(!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+    {
+        std::cerr << "Failed to write " << file.fileName().toStdString() << ": " << file.errorString().toStdString() << "\n";
+        return 1;
+    }
+    return 0;
+}
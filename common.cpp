@@ -1,4 +1,12 @@
 #include "common.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <QImage>
+#include <QObject>
+#include <QColorSpace>
+#include <QImageWriter>
+#include <QtConcurrent>
 
 QSurfaceFormat makeGLSurfaceFormat()
 {
@@ -7,3 +15,96 @@ QSurfaceFormat makeGLSurfaceFormat()
     format.setProfile(QSurfaceFormat::CoreProfile);
     return format;
 }
+
+namespace
+{
+// Part of an image for conversions on all cores, large enough to amortize the scheduling
+struct PixelRange
+{
+    size_t begin, end;
+    float max;
+};
+
+std::vector<PixelRange> pixelRanges(const size_t size)
+{
+    constexpr size_t rangeSize = 1<<16;
+    std::vector<PixelRange> ranges;
+    for(size_t begin=0; begin<size; begin+=rangeSize)
+        ranges.push_back({begin, std::min(begin+rangeSize, size), -INFINITY});
+    return ranges;
+}
+}
+
+std::vector<glm::vec4> averageSamples(const glm::vec4*const sums, const float*const counts, const size_t size)
+{
+    std::vector<glm::vec4> data(size);
+    auto ranges = pixelRanges(size);
+    QtConcurrent::blockingMap(ranges, [&](PixelRange const& range)
+    {
+        for(size_t i=range.begin; i<range.end; ++i)
+            data[i] = counts[i]>0 ? sums[i]/counts[i] : glm::vec4(0);
+    });
+    return data;
+}
+
+glm::vec3 XYZToLinearSRGB(glm::vec3 const& XYZ)
+{
+    using namespace glm;
+    static const auto XYZ2sRGBl=mat3(vec3(3.2406,-0.9689,0.0557),
+                                     vec3(-1.5372,1.8758,-0.204),
+                                     vec3(-0.4986,0.0415,1.057));
+    return XYZ2sRGBl * XYZ;
+}
+
+void toLinearSRGB(std::vector<glm::vec4>& data, const bool normalize)
+{
+    using namespace glm;
+    auto ranges = pixelRanges(data.size());
+    QtConcurrent::blockingMap(ranges, [&](PixelRange& range)
+    {
+        for(size_t i=range.begin; i<range.end; ++i)
+        {
+            const vec3 rgb = XYZToLinearSRGB(vec3(data[i]));
+            data[i] = vec4(rgb, 1);
+            range.max = std::max({range.max, rgb.r, rgb.g, rgb.b});
+        }
+    });
+    if(!normalize)
+        return;
+    float max = -INFINITY;
+    for(const auto& range : ranges)
+        max = std::max(max, range.max);
+    QtConcurrent::blockingMap(ranges, [&](PixelRange const& range)
+    {
+        for(size_t i=range.begin; i<range.end; ++i)
+            data[i] = vec4(vec3(data[i]) / max, 1);
+    });
+}
+
+QString saveLinearSRGBImage(QString const& path, std::vector<glm::vec4> const& data, const int width, const int height)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6,2,0)
+    QImage img(width, height, QImage::Format_RGBX32FPx4);
+    if(img.isNull())
+        return QObject::tr("out of memory");
+    // The data starts from the bottom row
+    for(int row=0; row<height; ++row)
+        std::memcpy(img.scanLine(height-1-row), data.data()+size_t(row)*width, size_t(width)*sizeof data[0]);
+    img.setColorSpace(QColorSpace::SRgbLinear);
+    QImageWriter writer(path);
+    writer.setFormat("tiff");
+    if(!writer.write(img))
+        return writer.errorString();
+    return {};
+#else
+    (void)path; (void)data; (void)width; (void)height;
+    return QObject::tr("saving float images requires Qt 6.2 or newer");
+#endif
+}
+
+QString saveLuminanceImage(QString const& path, std::vector<glm::vec4> data, const int width, const int height,
+                           const bool normalize)
+{
+    toLinearSRGB(data, normalize);
+    return saveLinearSRGBImage(path, data, width, height);
+}
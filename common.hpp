@@ -1,6 +1,9 @@
 #pragma once
 
+#include <vector>
+#include <QString>
 #include <QSurfaceFormat>
+#include <glm/glm.hpp>
 
 enum
 {
@@ -8,4 +11,20 @@ enum
     OPENGL_MINOR_VERSION=3,
 };
 
+// Wavelengths evaluated by one invocation of the glare shader. Larger batches share more
+// geometry work and draw calls, but keep more accumulators in registers.
+constexpr int wavelengthBatchSize=8;
+
 QSurfaceFormat makeGLSurfaceFormat();
+
+// Sums of XYZW over the samples of each pixel divided by the numbers of the samples
+std::vector<glm::vec4> averageSamples(const glm::vec4* sums, const float* counts, size_t size);
+glm::vec3 XYZToLinearSRGB(glm::vec3 const& XYZ);
+// Converts XYZW to linear sRGB, scaled so that the brightest channel is 1 if normalize is set.
+// Like the other conversions here, it runs on all cores.
+void toLinearSRGB(std::vector<glm::vec4>& data, bool normalize);
+// Writes linear sRGB, in the layout of CPUGlareRenderer, as a float TIFF, whose rows go from
+// the top. Returns an empty string on success, the error otherwise.
+QString saveLinearSRGBImage(QString const& path, std::vector<glm::vec4> const& data, int width, int height);
+// Both of the above
+QString saveLuminanceImage(QString const& path, std::vector<glm::vec4> data, int width, int height, bool normalize=true);
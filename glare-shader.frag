@@ -1,17 +1,48 @@
 R"(
 #version 330
-uniform int pointCount;
-uniform int arcPointCount;
-uniform float curvatureRadius; // mm
+// Vertices (xy,zw) of the triangles that form the aperture together with the origin, in mm
+uniform samplerBuffer apertureTriangles;
+uniform int triangleCount;
+// Whether to sum over the outer edges of the triangles instead of the triangles themselves
+uniform bool edgeFormula;
+uniform float apertureMaxRadius; // mm, distance of the farthest vertex from the origin
+// Below this |k|*apertureMaxRadius the edge sum loses precision, as in TriangleKernel::minEdgeFormulaKR
+const float MIN_EDGE_FORMULA_KR = 1;
 uniform vec2 sampleShift; // px
 uniform float targetWidth; // mm
-uniform float wavenumber; // mm^-1
-uniform float globalRotationAngle;
-uniform vec4 radianceToLuminance;
 uniform vec2 imageSize; // px
-uniform float apertureRadius; // mm
-uniform float colorScale;
-out vec4 XYZW;
+// The image shows the pattern magnified by zoom, a power of 2, with its bottom left pixel at
+// viewOrigin px of the magnified pattern from its center
+uniform float zoom;
+uniform vec2 viewOrigin;
+// Wavelengths are evaluated in batches, sharing the geometry work. Two texels per wavelength:
+// XYZW weight of |F|², and the wavenumber in mm^-1 as in Canvas::setupSpectrum().
+// Each instance of the draw takes the next batch.
+const int MAX_BATCH_SIZE = WAVELENGTH_BATCH_SIZE;
+uniform samplerBuffer spectrum;
+uniform int wavelengthCount;
+flat in int batchIndex;
+int batchStart, batchSize; // set in main()
+// Coordinates of the output. In the polar modes x is the distance from the center,
+// y is the angle counted from wedgeStartAngle.
+const int IMAGE_COORDINATES=0;
+const int POLAR_IMAGE_COORDINATES=1; // distance in px
+const int POLAR_K_COORDINATES=2; // distance is |k|, the output is |F|² with no spectral weight
+uniform int coordinates;
+uniform float wedgeStartAngle;
+uniform vec2 wedgeStep; // px or mm^-1, and radians per texel
+// Optionally the transform of the first side is looked up in a table instead, see SideTransformTable
+uniform bool sideTable;
+uniform sampler2D sideTransform; // complex, in polar coordinates (|k|, angle of k)
+uniform vec2 sideTableStep; // mm^-1 and radians per texel
+uniform int sideCount;
+uniform vec2 sideCentroid; // mm, the table is demodulated by exp(ik·sideCentroid)
+// 1 for the samples in the second of the two halves that adaptive sampling compares
+uniform float secondHalf;
+layout(location=0) out vec4 XYZW;
+// Per-pixel statistics, summed over samples: the count of samples, the count of those in the
+// second half, and the sum of luminance Y over the second half
+layout(location=1) out vec4 sampleStats;
 const float PI=3.14159265;
 
 #if COSINE_IS_BROKEN
@@ -36,86 +67,243 @@ float triangleArea(vec2 p1, vec2 p2, vec2 p3)
 float sinc(float x) { return abs(x)<1e-4 ? 1 : sin(x)/x; }
 float sqr(float x) { return x*x; }
 
-// Ref: Equations (4.1), (4.2), but altering the definition of sinc, in
-//      R.M. Sillitto, W. Sillitto, "A Simple Fourier Approach to Fraunhofer Diffraction by Triangular Apertures"
-//      http://dx.doi.org/10.1080/713819012
-vec2 triangle(vec2 s1, vec2 s2, vec2 s3, vec2 k)
+// The parts of triangle() that depend on k only through its direction: the halves of the two
+// side projections, alpha and beta, and the projection of the origin shift, all for k=dir.
+// Which pair of sides is used doesn't depend on the length of k either.
+vec3 triangleProjections(vec2 s1, vec2 s2, vec2 s3, vec2 dir)
 {
-    if(k==vec2(0)) return vec2(1,0);
     vec2 a1=s3-s2;
     vec2 b1=s1-s3;
-    vec2 c1=s2-s1;
-    float alpha1=dot(a1,k)/2;
-    float beta1 =dot(b1,k)/2;
+    float alpha1=dot(a1,dir)/2;
+    float beta1 =dot(b1,dir)/2;
 
     vec2 a2=s1-s3;
     vec2 b2=s2-s1;
-    vec2 c2=s3-s2;
-    float alpha2=dot(a2,k)/2;
-    float beta2 =dot(b2,k)/2;
+    float alpha2=dot(a2,dir)/2;
+    float beta2 =dot(b2,dir)/2;
 
-    float alpha, beta;
-    vec2 originShift;
     // Try to avoid denominator close to zero
     if(abs(alpha1+beta1) > abs(alpha2+beta2))
-    {
-        alpha=alpha1;
-        beta =beta1;
-        originShift=s3;
-    }
+        return vec3(alpha1, beta1, dot(dir,s3));
     else
-    {
-        alpha=alpha2;
-        beta =beta2;
-        originShift=s1;
-    }
+        return vec3(alpha2, beta2, dot(dir,s1));
+}
+
+// Ref: Equations (4.1), (4.2), but altering the definition of sinc, in
+//      R.M. Sillitto, W. Sillitto, "A Simple Fourier Approach to Fraunhofer Diffraction by Triangular Apertures"
+//      http://dx.doi.org/10.1080/713819012
+// Evaluated at k=wavenumber*dir from triangleProjections() for dir
+vec2 triangleFromProjections(vec3 projections, float wavenumber)
+{
+    float alpha=wavenumber*projections.x;
+    float beta =wavenumber*projections.y;
+    // Only at k=0 for a non-degenerate triangle
+    if(alpha+beta==0) return vec2(1,0);
     float reY=(alpha*sqr(sinc(alpha))+beta*sqr(sinc(beta)))/(alpha+beta);
     float imY=(sinc(2*beta)-sinc(2*alpha))/(alpha+beta);
-    float reShiftExp =  cos(dot(k,originShift));
-    float imShiftExp = -sin(dot(k,originShift));
+    float phase=wavenumber*projections.z;
+    float reShiftExp =  cos(phase);
+    float imShiftExp = -sin(phase);
     return vec2(reY*reShiftExp-imY*imShiftExp,
                 imY*reShiftExp+reY*imShiftExp);
 }
 
+vec2 triangle(vec2 s1, vec2 s2, vec2 s3, vec2 k)
+{
+    return triangleFromProjections(triangleProjections(s1,s2,s3,k), 1);
+}
+
+// Transform of the whole closed fan of triangles via Green's theorem, see evaluateEdgesScalar()
+// in TriangleKernel.cpp for the derivation. It needs one exponential per vertex instead of the
+// four sines and a phase of triangle(), and stays finite where k is orthogonal to an edge.
+vec2 apertureByEdges(vec2 k)
+{
+    vec2 sum = vec2(0);
+    vec2 firstVertex = texelFetch(apertureTriangles, 0).xy;
+    float phaseA = dot(k, firstVertex);
+    vec2 expA = vec2(cos(phaseA), -sin(phaseA));
+    for(int triangleNum=0; triangleNum<triangleCount; ++triangleNum)
+    {
+        vec4 arcPoints = texelFetch(apertureTriangles, triangleNum);
+        vec2 edge = arcPoints.zw - arcPoints.xy;
+        float phaseB = dot(k, arcPoints.zw);
+        vec2 expB = vec2(cos(phaseB), -sin(phaseB));
+        float kCrossEdge = k.x*edge.y - k.y*edge.x;
+        float h = dot(k, edge)/2;
+        if(abs(h) < 0.25)
+        {
+            // exp(-ik·midpoint)*sinc(h) = (expA+expB)/2 * tan(h)/h
+            float h2 = h*h;
+            sum += kCrossEdge * (1 + h2*(1./3 + h2*(2./15 + h2*(17./315)))) * (expA+expB);
+        }
+        else
+        {
+            // exp(-ik·midpoint)*sinc(h) = (expA-expB)/(2ih)
+            vec2 diff = expA-expB;
+            sum += kCrossEdge/h * vec2(diff.y, -diff.x);
+        }
+        expA = expB;
+    }
+    // Multiply by -i/|k|²
+    return vec2(sum.y, -sum.x) / dot(k,k);
+}
+
+vec2 complexMul(vec2 a, vec2 b) { return vec2(a.x*b.x-a.y*b.y, a.x*b.y+a.y*b.x); }
+
+// Every side is the first one rotated, so its transform is the tabulated one at counter-rotated k
+vec2 apertureBySideTable(vec2 k)
+{
+    float kLen = length(k);
+    float kAngle = kLen > 0 ? atan(k.y, k.x) : 0;
+    vec2 tableSize = textureSize(sideTransform, 0);
+    float centroidDist = length(sideCentroid);
+    float centroidAngle = atan(sideCentroid.y, sideCentroid.x);
+    vec2 sum = vec2(0);
+    for(int side=0; side<sideCount; ++side)
+    {
+        float rotation = 2*PI*side/sideCount;
+        vec2 F = texture(sideTransform, vec2(kLen, kAngle-rotation) / sideTableStep / tableSize).rg;
+        // k·(sideCentroid rotated by rotation)
+        float phase = kLen*centroidDist*cos(kAngle-rotation-centroidAngle);
+        sum += complexMul(F, vec2(cos(phase), -sin(phase)));
+    }
+    return sum;
+}
+
+vec2 aperture(vec2 k)
+{
+    if(sideTable)
+        return apertureBySideTable(k);
+    if(edgeFormula && dot(k,k)*sqr(apertureMaxRadius) >= sqr(MIN_EDGE_FORMULA_KR))
+        return apertureByEdges(k);
+
+    const vec2 p0=vec2(0,0);
+    vec2 F = vec2(0);
+    for(int triangleNum=0; triangleNum<triangleCount; ++triangleNum)
+    {
+        vec4 arcPoints = texelFetch(apertureTriangles, triangleNum);
+        F += triangleArea(p0,arcPoints.xy,arcPoints.zw) * triangle(p0,arcPoints.xy,arcPoints.zw,k);
+    }
+    return F;
+}
+
+// apertureByEdges() at k=wavenumbers[i]*dir for the whole batch. The vertices are fetched and
+// projected onto dir once for all the wavelengths.
+void apertureByEdgesBatch(vec2 dir, float wavenumbers[MAX_BATCH_SIZE], out vec2 F[MAX_BATCH_SIZE])
+{
+    vec2 sums[MAX_BATCH_SIZE];
+    vec2 expA[MAX_BATCH_SIZE];
+    float projA = dot(dir, texelFetch(apertureTriangles, 0).xy);
+    for(int i=0; i<batchSize; ++i)
+    {
+        float phaseA = wavenumbers[i]*projA;
+        expA[i] = vec2(cos(phaseA), -sin(phaseA));
+        sums[i] = vec2(0);
+    }
+    for(int triangleNum=0; triangleNum<triangleCount; ++triangleNum)
+    {
+        vec4 arcPoints = texelFetch(apertureTriangles, triangleNum);
+        vec2 edge = arcPoints.zw - arcPoints.xy;
+        float projB = dot(dir, arcPoints.zw);
+        float dirCrossEdge = dir.x*edge.y - dir.y*edge.x;
+        float halfProjEdge = dot(dir, edge)/2;
+        for(int i=0; i<batchSize; ++i)
+        {
+            float phaseB = wavenumbers[i]*projB;
+            vec2 expB = vec2(cos(phaseB), -sin(phaseB));
+            float h = wavenumbers[i]*halfProjEdge;
+            if(abs(h) < 0.25)
+            {
+                float h2 = h*h;
+                sums[i] += wavenumbers[i]*dirCrossEdge * (1 + h2*(1./3 + h2*(2./15 + h2*(17./315)))) * (expA[i]+expB);
+            }
+            else
+            {
+                vec2 diff = expA[i]-expB;
+                sums[i] += dirCrossEdge/halfProjEdge * vec2(diff.y, -diff.x);
+            }
+            expA[i] = expB;
+        }
+    }
+    for(int i=0; i<batchSize; ++i)
+        F[i] = vec2(sums[i].y, -sums[i].x) / (sqr(wavenumbers[i])*dot(dir,dir));
+}
+
+void apertureBatch(vec2 dir, float wavenumbers[MAX_BATCH_SIZE], out vec2 F[MAX_BATCH_SIZE])
+{
+    float minWavenumber = wavenumbers[0];
+    for(int i=1; i<batchSize; ++i)
+        minWavenumber = min(minWavenumber, wavenumbers[i]);
+
+    if(sideTable)
+    {
+        for(int i=0; i<batchSize; ++i)
+            F[i] = apertureBySideTable(wavenumbers[i]*dir);
+    }
+    else if(edgeFormula && sqr(minWavenumber)*dot(dir,dir)*sqr(apertureMaxRadius) >= sqr(MIN_EDGE_FORMULA_KR))
+    {
+        apertureByEdgesBatch(dir, wavenumbers, F);
+    }
+    else
+    {
+        const vec2 p0=vec2(0,0);
+        for(int i=0; i<batchSize; ++i)
+            F[i] = vec2(0);
+        for(int triangleNum=0; triangleNum<triangleCount; ++triangleNum)
+        {
+            vec4 arcPoints = texelFetch(apertureTriangles, triangleNum);
+            float area = triangleArea(p0,arcPoints.xy,arcPoints.zw);
+            // The sides are projected onto dir once for all the wavelengths
+            vec3 projections = triangleProjections(p0,arcPoints.xy,arcPoints.zw,dir);
+            for(int i=0; i<batchSize; ++i)
+                F[i] += area * triangleFromProjections(projections, wavenumbers[i]);
+        }
+    }
+}
+
 void main()
 {
     XYZW=vec4(0);
-    const vec2 p0=vec2(0,0);
-    // Distance from the center in mm at a distance of 10m from the aperture
-    vec2 pointInTargetPlane = (gl_FragCoord.st - round(imageSize/2) + sampleShift) / (imageSize.x/2) * targetWidth;
-    const float distToTargetPlane = 10e3; // mm
-    // Distance from the center of the aperture to the point in the target plane
-    float distToPoint = sqrt(dot(pointInTargetPlane, pointInTargetPlane) + sqr(distToTargetPlane));
-    // Projection of the wave vector onto the plane of the aperture
-    vec2 k = wavenumber * pointInTargetPlane / distToPoint;
-
-    float XYZW_re=0, XYZW_im=0;
-    for(int pointNum=1; pointNum<=pointCount; ++pointNum)
+    batchStart = batchIndex*MAX_BATCH_SIZE;
+    batchSize = min(MAX_BATCH_SIZE, wavelengthCount-batchStart);
+    if(coordinates == POLAR_K_COORDINATES)
+    {
+        vec2 polar = (gl_FragCoord.st - 0.5 + sampleShift) * wedgeStep;
+        float angle = wedgeStartAngle + polar.y;
+        vec2 F = aperture(polar.x * vec2(cos(angle), sin(angle)));
+        XYZW = vec4(dot(F,F));
+    }
+    else
     {
-        float phi1 = 2*PI*(pointNum-1)/pointCount + (pointCount%2==1 ? PI/2 : 0) + globalRotationAngle;
-        float phi2 = 2*PI* pointNum   /pointCount + (pointCount%2==1 ? PI/2 : 0) + globalRotationAngle;
-        vec2 p1=vec2(cos(phi1), sin(phi1));
-        vec2 p2=vec2(cos(phi2), sin(phi2));
-        vec2 midPoint = (p1+p2)/2;
-        float arcCenterDistFromMid = sqrt(sqr(curvatureRadius)-dot(p1-p2,p1-p2)/4);
-        vec2 arcCenter = midPoint * (1-arcCenterDistFromMid/length(midPoint));
-        float arcPhi1 = atan(p1.y-arcCenter.y, p1.x-arcCenter.x);
-        float arcPhi2 = atan(p2.y-arcCenter.y, p2.x-arcCenter.x);
-        if(arcPhi2<arcPhi1) arcPhi2 += 2*PI;
-        for(float arcPointNum=0; arcPointNum<=arcPointCount; ++arcPointNum)
+        vec2 posInImage; // px from the center
+        if(coordinates == POLAR_IMAGE_COORDINATES)
+        {
+            vec2 polar = (gl_FragCoord.st - 0.5 + sampleShift) * wedgeStep;
+            float angle = wedgeStartAngle + polar.y;
+            posInImage = polar.x * vec2(cos(angle), sin(angle));
+        }
+        else
         {
-            float angle1=arcPhi1+(arcPhi2-arcPhi1)* arcPointNum   /(arcPointCount+1);
-            float angle2=arcPhi1+(arcPhi2-arcPhi1)*(arcPointNum+1)/(arcPointCount+1);
-            vec2 arcP1 = arcCenter + curvatureRadius*vec2(cos(angle1), sin(angle1));
-            vec2 arcP2 = arcCenter + curvatureRadius*vec2(cos(angle2), sin(angle2));
-            arcP1 *= apertureRadius;
-            arcP2 *= apertureRadius;
-            float area = triangleArea(p0,arcP1,arcP2);
-            vec2 tri = triangle(p0,arcP1,arcP2,k);
-            XYZW_re += area*tri.x;
-            XYZW_im += area*tri.y;
+            posInImage = (gl_FragCoord.st + viewOrigin + sampleShift) / zoom;
         }
+        // Distance from the center in mm at a distance of 10m from the aperture
+        vec2 pointInTargetPlane = posInImage / (imageSize.x/2) * targetWidth;
+        const float distToTargetPlane = 10e3; // mm
+        // Distance from the center of the aperture to the point in the target plane
+        float distToPoint = sqrt(dot(pointInTargetPlane, pointInTargetPlane) + sqr(distToTargetPlane));
+        // Projection of the wave vector onto the plane of the aperture, per unit wavenumber
+        vec2 dir = pointInTargetPlane / distToPoint;
+
+        float wavenumbers[MAX_BATCH_SIZE];
+        for(int i=0; i<batchSize; ++i)
+            wavenumbers[i] = texelFetch(spectrum, 2*(batchStart+i)+1).x;
+        vec2 F[MAX_BATCH_SIZE];
+        apertureBatch(dir, wavenumbers, F);
+        for(int i=0; i<batchSize; ++i)
+            XYZW += texelFetch(spectrum, 2*(batchStart+i)) * dot(F[i],F[i]);
     }
-    XYZW += colorScale*radianceToLuminance*(XYZW_re*XYZW_re+XYZW_im*XYZW_im);
+    // Only one batch of each sample counts it
+    float countIncrement = batchIndex==0 ? 1 : 0;
+    sampleStats = vec4(countIncrement, secondHalf*countIncrement, secondHalf*XYZW.y, 0);
 }
-)"
+)"
\ No newline at end of file
@@ -0,0 +1,12 @@
+R"(
+#version 330
+// Each instance evaluates one batch of wavelengths. Depth isn't written, so all of them pass
+// the depth test, except in the pixels masked as converged.
+in vec3 vertex;
+flat out int batchIndex;
+void main()
+{
+    batchIndex=gl_InstanceID;
+    gl_Position=vec4(vertex.xy, 0, 1);
+}
+)"
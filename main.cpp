@@ -23,6 +23,8 @@ int main(int argc, char** argv)
     const auto widget=QWidget::createWindowContainer(canvas);
     QObject::connect(tools, &ToolsWidget::settingChanged, canvas, qOverload<>(&Canvas::update));
     mainWin.setCentralWidget(widget);
+    QObject::connect(canvas, &Canvas::renderStatusChanged, mainWin.statusBar(),
+                     [statusBar=mainWin.statusBar()](QString const& status){ statusBar->showMessage(status); });
     mainWin.addDockWidget(Qt::TopDockWidgetArea, tools);
 
     const auto apertureOutline = new ApertureOutline(tools);